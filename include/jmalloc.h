@@ -3,15 +3,162 @@
 
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Public API (changed name to j_~ avoid clashing with libc)
 void *j_malloc(size_t size);
 void  j_free(void *ptr);
 void *j_realloc(void *ptr, size_t new_size);
+// n * size zeroed bytes (NULL with ENOMEM on overflow); skips the memset when the
+// block it gets is known to be zero (fresh pages, or pre-zeroed, see j_prezero)
+void *j_calloc(size_t n, size_t size);
+// free n blocks taking the heap lock once (NULL entries are skipped)
+void  j_free_batch(void **ptrs, size_t n);
+// co-allocate n sub-objects (sizes[i] bytes, aligned to aligns[i], a power of two;
+// aligns may be NULL for 8) contiguously in one block. out_ptrs[i] receives each
+// sub-object; the return value is what to pass to j_free (it equals out_ptrs[0]
+// when no alignment above 8 is requested)
+void *j_malloc_multi(const size_t *sizes, const size_t *aligns, size_t n, void **out_ptrs);
+
+// allocation hooks
+// pre hooks run before the operation and may return non-zero to make it fail
+// (j_malloc/j_realloc then return NULL), post hooks run after it.
+// any callback may be NULL. allocations made from inside a hook bypass the hooks.
+typedef struct j_hooks {
+    int  (*pre_malloc)(size_t size, void *ctx);
+    void (*post_malloc)(void *ptr, size_t size, void *ctx);
+    void (*pre_free)(void *ptr, void *ctx);
+    void (*post_free)(void *ptr, void *ctx);
+    int  (*pre_realloc)(void *ptr, size_t new_size, void *ctx);
+    void (*post_realloc)(void *old_ptr, void *new_ptr, size_t new_size, void *ctx);
+    void *ctx; // passed back to every callback
+} j_hooks_t;
+
+// install hooks (copied), or remove them with NULL.
+// hooks are meant to be set up before other threads start allocating.
+void j_set_hooks(const j_hooks_t *hooks);
+
+// allocation trace
+// while a trace runs, every successful j_malloc/j_free/j_realloc (and what is
+// built on them) is appended to path as one text line, in the order the heap saw
+// them: "a <ptr> <size>", "f <ptr>", "r <old> <new> <size>". tools/jsim replays
+// such a trace against models of the placement policies. tracing takes the same
+// slow path as hooks and holds the heap lock while writing.
+int  j_trace_start(const char *path); // 0, or -1 with errno set (replaces a running trace)
+void j_trace_stop();
+
+// tagged allocation
+// a small tag id (< J_MAX_TAGS) is kept in the block header so live bytes can be
+// attributed to a subsystem. plain j_malloc uses tag 0; j_realloc keeps the tag.
+#define J_MAX_TAGS 64
+void *j_malloc_tagged(unsigned tag, size_t size);
+
+typedef struct j_tag_usage {
+    unsigned tag;
+    long long live_bytes;           // payload bytes currently allocated
+    long long live_count;           // blocks currently allocated
+    unsigned long long total_allocs; // allocations since start
+} j_tag_usage_t;
+
+// fill out[] with up to max entries, one per tag that has been used,
+// and return how many such tags exist
+size_t j_tag_usage(j_tag_usage_t *out, size_t max);
+
+// per-thread statistics
+// every thread that allocates or frees gets a record of plain counters that
+// only it writes; j_thread_stats walks the registry. threads that have exited
+// are summed into one entry with id 0 and the name "(exited)". a remote free is
+// a block freed by a different thread than the one that allocated it, told
+// apart by an 8-bit owner id: ids of exited threads are reused, so a block left
+// by an exited thread may count as local to a newer one, and beyond 255 live
+// threads two of them share an id and their frees of each other's blocks are
+// not counted. heap_grows counts allocations no free block could serve, so the
+// heap had to map more (misses of the thread cache are in j_tcache_stats).
+#define J_THREAD_NAME_MAX 16
+typedef struct j_thread_stats {
+    unsigned long long id;       // registration order, 0 for exited threads
+    char name[J_THREAD_NAME_MAX]; // j_thread_name, else the OS thread name at registration
+    unsigned long long allocs;
+    unsigned long long frees;
+    unsigned long long bytes_allocated;
+    unsigned long long bytes_freed;
+    unsigned long long remote_frees;
+    unsigned long long heap_grows;
+    size_t tcache_bytes;          // blocks parked in its thread cache (j_thread_cache)
+    size_t tcache_capacity_bytes; // what its thread cache may hold right now
+} j_thread_stats_t;
+
+// label the calling thread (truncated to J_THREAD_NAME_MAX - 1 bytes)
+void j_thread_name(const char *name);
+// fill out[] with up to max entries and return how many exist
+size_t j_thread_stats(j_thread_stats_t *out, size_t max);
+
+// flight recorder
+// the allocator always keeps its last J_FLIGHT_EVENTS rare events in a small
+// in-memory ring: arena maps and unmaps, purge batches, allocations of 1 MiB or
+// more, failed allocations, soft budget crossings and, when asked for, a heap
+// snapshot every few seconds. the malloc/free fast paths record nothing.
+// j_flight_recorder installs handlers for SIGSEGV, SIGBUS, SIGILL, SIGFPE and
+// SIGABRT that write the ring to path (NULL: jmalloc-flight.<pid>.log in the
+// working directory) with async-signal-safe calls only, then pass the signal on
+// to the previous handler, so the core is still written. snapshot_secs > 0
+// records heap and free bytes that often from the background thread.
+// call it again to change the path or the interval; handlers are installed once.
+#define J_FLIGHT_EVENTS 1024
+int j_flight_recorder(const char *path, unsigned snapshot_secs); // 0, or -1 with errno set
+// write the ring as text to fd, oldest event first (async-signal-safe); returns the events written
+size_t j_flight_dump(int fd);
+
+// thread cache
+// with a budget, j_free parks blocks of up to J_TCACHE_MAX_SIZE bytes in the
+// freeing thread's cache, one list per 8-byte class, and j_malloc/
+// j_malloc_tagged on that thread take them back without the heap lock. every
+// list sizes itself: a miss after the list had to spill blocks to the heap grows
+// it, and blocks that sit unused for a while go back with part of its capacity.
+// the capacity of all lists of all threads stays under budget_bytes (halved,
+// quartered and cut to a sixteenth at the pressure levels, the excess taken
+// back at once); a list that needs more takes it from the thread that has
+// cached least lately (that thread hands the blocks back on its next free of
+// the class or at exit).
+// j_calloc, the hooked paths and split heaps (site groups, per-thread heaps)
+// bypass the cache. 0 (or splitting the heaps) turns it off: all capacity is
+// released at once, the calling thread's cache is emptied, and every other
+// thread empties its own on its next malloc or free, or when it exits.
+#define J_TCACHE_CLASSES 64
+#define J_TCACHE_MAX_SIZE 512
+void j_thread_cache(size_t budget_bytes);
+void j_thread_cache_flush(); // hand the calling thread's cached blocks back to the heap
+
+typedef struct j_tcache_class {
+    size_t size;                   // block payload size of the class
+    unsigned long long capacity;   // blocks, summed over live threads
+    unsigned long long max_capacity; // largest capacity of one thread
+    unsigned long long cached;     // blocks parked now
+    unsigned long long hits;       // allocations served from the cache
+    unsigned long long misses;     // allocations that found the list empty
+    unsigned long long overflows;  // frees that found the list full
+} j_tcache_class_t;
+typedef struct j_tcache_stats {
+    size_t budget;                 // as set, before any cut for memory pressure
+    size_t capacity_bytes;         // granted to all lists
+    size_t cached_bytes;           // parked in them
+    size_t threads;                // live threads with a record
+    unsigned long long steals;     // times a list took capacity from another thread
+    unsigned long long hits, misses, overflows; // all classes, exited threads included
+    j_tcache_class_t classes[J_TCACHE_CLASSES];
+} j_tcache_stats_t;
+void j_tcache_stats(j_tcache_stats_t *out);
 
 // header for each block
 typedef struct block_header {
     size_t size; // payload size
-    int free; // 1 if free, 0 if used
+    unsigned char free; // 1 if free, 0 if used
+    unsigned char group; // heap (call-site group) the block belongs to
+    unsigned short tag; // accounting tag (j_malloc_tagged)
+    unsigned short flags; // page state bits, internal
+    unsigned short site; // allocation site id while leak tracking is on, 0 = unknown
     // doubly linked list pointers
     struct block_header *next;
     struct block_header *prev;
@@ -23,10 +170,264 @@ typedef struct arena_header {
     struct arena_header *next;
     struct arena_header *prev;
     block_header_t *first_block; // pointer to first block in the arena
+    int buf_index; // io_uring fixed buffer slot, -1 if not registered
 } arena_header_t;
 
 // stats
 size_t j_heap_bytes();
 size_t j_free_bytes();
+size_t j_largest_free(); // largest free block; 1 - largest/free bytes measures fragmentation
+
+// arena occupancy
+typedef struct j_arena_stats {
+    size_t arenas;        // arenas mapped
+    size_t empty_arenas;  // arenas with no live block (what j_trim releases)
+    size_t sparse_arenas; // arenas less than a quarter full
+    size_t live_bytes;    // payload bytes allocated (blocks parked in thread caches are not)
+    size_t mapped_bytes;  // bytes mapped for arenas, as j_heap_bytes()
+    unsigned long long steals;       // empty arenas one heap took from another
+    unsigned long long stolen_bytes;
+} j_arena_stats_t;
+void j_arena_stats(j_arena_stats_t *out);
+
+// heap map
+// writes a CSV with one row per page of every arena, oldest arena of each group
+// first: "arena,group,page,alloc,free,purged,meta", the bytes of the page that
+// are allocated payload, free payload, free payload purged by j_purge, and block
+// or arena headers (plus unusable slack). blocks parked in thread caches count
+// as free payload. tools/jheatmap renders it.
+int j_heap_map(const char *path); // 0, or -1 with errno set
+
+// returning memory to the OS
+size_t j_purge(); // drop physical pages inside free blocks, returns bytes purged
+
+// purge cost. page ranges are sorted and merged before they are released, and
+// on Linux kernels that accept MADV_DONTNEED through process_madvise, up to 512
+// of them go out in one system call; otherwise each merged range is one madvise.
+typedef struct j_purge_stats {
+    unsigned long long bytes_purged;
+    unsigned long long ranges;   // page ranges queued, before merging
+    unsigned long long syscalls; // madvise / process_madvise / MEM_RESET calls
+    double syscalls_per_gb;      // syscalls per GiB purged
+    int batched;                 // 1 once process_madvise has been used
+} j_purge_stats_t;
+void j_purge_stats(j_purge_stats_t *out);
+size_t j_trim();  // unmap arenas that are entirely free, returns bytes released
+
+// background pre-zeroing
+// j_prezero(target) has the background thread keep up to target bytes of free
+// memory zeroed ahead of time (0 stops it), so j_calloc can hand out known-zero
+// blocks without a memset on the request path. large idle spans are purged
+// rather than written where the OS refills purged pages with zeros (Linux).
+int j_prezero(size_t target_bytes); // 0, or -1 if the background thread cannot start
+
+typedef struct j_zero_stats {
+    unsigned long long calloc_calls;
+    unsigned long long bytes_known_zero; // j_calloc bytes served without a memset
+    unsigned long long bytes_memset;     // j_calloc bytes zeroed on the request path
+    unsigned long long bg_bytes_zeroed;  // written by the background thread
+    unsigned long long bg_bytes_purged;  // zeroed by purging
+    size_t zero_free_bytes;              // free bytes currently known to be zero
+} j_zero_stats_t;
+void j_zero_stats(j_zero_stats_t *out);
+
+// placement policy
+// how a free block is chosen for an allocation. the JMALLOC_POLICY environment
+// variable ("first", "next", "best", "address") picks the policy when the heap
+// is first used, unless j_set_policy was called before that.
+typedef enum {
+    J_POLICY_FIRST_FIT,       // first fitting block in list order (default)
+    J_POLICY_NEXT_FIT,        // first fit, resuming where the last search stopped
+    J_POLICY_BEST_FIT,        // smallest fitting block
+    J_POLICY_ADDRESS_ORDERED, // lowest-address fitting block
+    J_POLICY_COUNT
+} j_policy_t;
+int         j_set_policy(j_policy_t policy); // 0, or -1 with errno = EINVAL
+j_policy_t  j_get_policy();
+const char *j_policy_name(j_policy_t policy); // NULL for an unknown policy
+
+// size classes
+// requests are normally rounded up to 8 bytes. with a class table installed,
+// requests up to the largest class are rounded up to the next class instead, so
+// blocks freed by one size are reused by its neighbours. a table can be derived
+// from an allocation size histogram so the padding it adds is minimal for a
+// given number of classes, either online over a warm-up window or offline.
+// JMALLOC_SIZE_CLASSES=<file> loads a saved table when the heap is first used.
+#define J_SIZECLASS_MAX_BYTES 4096                     // largest class / histogram size
+#define J_SIZECLASS_BINS      (J_SIZECLASS_MAX_BYTES / 8) // hist[i] counts requests of (i + 1) * 8 bytes
+#define J_SIZECLASS_MAX_COUNT 128
+
+int    j_sizeclass_set(const size_t *classes, size_t n); // ascending multiples of 8; n == 0 removes the table
+size_t j_sizeclass_get(size_t *out, size_t max);         // copies the table, returns its length
+// best table of at most max_classes covering every size in hist; returns the
+// number of classes written to out, *waste_out (optional) gets padding / requested bytes
+size_t j_sizeclass_derive(const unsigned long long *hist, size_t max_classes, size_t *out, double *waste_out);
+// record the next `window` allocation sizes, then derive and install a table
+int    j_sizeclass_autotune(unsigned long long window, size_t max_classes);
+void   j_sizeclass_histogram(unsigned long long *out); // last recorded histogram, J_SIZECLASS_BINS entries
+int    j_sizeclass_save(const char *path);             // one class per line
+int    j_sizeclass_load(const char *path);
+
+// call-site segregation
+// with groups > 1, j_malloc and j_malloc_tagged hash their return address into
+// one of `groups` site groups and every group allocates from its own arenas, so
+// objects from one call site (which tend to die together) do not pin the arenas
+// of another. blocks keep their group across j_realloc. 0 or 1 turns it off;
+// like hooks, it is meant to be set before other threads start allocating.
+#define J_MAX_SITE_GROUPS 16
+int j_site_groups(unsigned groups); // 0, or -1 with errno = EINVAL above J_MAX_SITE_GROUPS
+
+// per-thread heaps
+// with heaps > 1, every thread allocates from heap (n - 1) % heaps, where n
+// counts threads in the order they first used the allocator, so each thread's
+// objects share arenas only with its own. overrides call-site groups while on.
+// all heaps share the one heap lock. whenever heaps are split (either way), a
+// heap that has no fitting free block steals an empty arena from the heap with
+// the most bytes in empty arenas before mapping a new one, so a consumer does
+// not grow the footprint while a producer sits on free spans; j_arena_stats
+// counts the steals.
+int j_thread_heaps(unsigned heaps); // 0, or -1 with errno = EINVAL above J_MAX_SITE_GROUPS
+
+// leak report
+// while tracking is on, every allocation stores a 16-bit id of its call site
+// (the return address of j_malloc, j_malloc_tagged, j_calloc or
+// j_realloc(NULL, n)) in the block header, a hash and one store. a report
+// walks the heap and sums the live blocks per site, largest first. sites are
+// raw code addresses; addr2line -f -e <binary> (minus the load address for
+// PIE builds) turns them into functions.
+// blocks allocated while tracking was off count under site NULL.
+typedef struct j_site_usage {
+    const void *site; // return address, NULL for untracked blocks
+    size_t blocks;    // live blocks
+    size_t bytes;     // live payload bytes
+} j_site_usage_t;
+
+// report_at_exit prints j_leak_report(NULL) from an atexit handler
+int j_leak_tracking(int enable, int report_at_exit); // 0, or -1 if the site table cannot be mapped
+size_t j_leak_sites(j_site_usage_t *out, size_t max); // fill up to max, return how many sites have live blocks
+size_t j_leak_report(const char *path);               // NULL = stderr; returns live blocks
+
+// memory budget (0 disables a limit)
+// limits apply to j_heap_bytes() and are only checked when the heap grows.
+// growing past soft_limit calls cb once (until the heap shrinks back under it),
+// then purges and trims; growing past hard_limit fails with ENOMEM.
+typedef void (*j_budget_cb)(size_t heap_bytes, size_t soft_limit, void *ctx);
+void j_set_budget(size_t soft_limit, size_t hard_limit, j_budget_cb cb, void *ctx);
+
+// memory pressure monitor (Linux PSI + cgroup v2)
+// reads memory pressure and the cgroup's memory.current / memory.high, and the
+// higher the level, the more eagerly free pages are purged and empty arenas
+// unmapped, and the less the thread caches may hold (see j_thread_cache).
+// polled when the heap grows (at most once per poll_interval_ms) or via j_pressure_poll.
+enum { J_PRESSURE_NONE = 0, J_PRESSURE_MODERATE, J_PRESSURE_HIGH, J_PRESSURE_CRITICAL };
+
+typedef struct j_pressure_config {
+    const char *psi_path;            // NULL = /proc/pressure/memory
+    const char *cgroup_current_path; // NULL = /sys/fs/cgroup/memory.current
+    const char *cgroup_high_path;    // NULL = /sys/fs/cgroup/memory.high
+    double psi_moderate;   // "some avg10" percent for MODERATE (0 = 5.0)
+    double psi_high;       // "some avg10" percent for HIGH (0 = 20.0)
+    double usage_moderate; // memory.current / memory.high for MODERATE (0 = 0.80)
+    double usage_high;     // ... for HIGH (0 = 0.90)
+    double usage_critical; // ... for CRITICAL (0 = 0.97)
+    unsigned poll_interval_ms; // 0 = 100
+} j_pressure_config_t;
+
+int  j_pressure_enable(const j_pressure_config_t *cfg); // NULL = defaults, returns first level
+void j_pressure_disable();
+int  j_pressure_poll();  // read the sources now and adapt, returns the level (-1 if disabled)
+int  j_pressure_level(); // last level seen
+
+// io_uring registered-buffer mode (Linux)
+// j_uring_attach creates a sparse fixed-buffer table of max_buffers slots on the
+// ring and registers every arena as one buffer, now and as new arenas are mapped.
+// j_uring_buf_index(ptr) gives the buf_index to use with IORING_OP_READ_FIXED /
+// WRITE_FIXED on j_malloc'd memory, or -1 if its arena is not registered.
+int  j_uring_attach(int ring_fd, unsigned max_buffers);
+void j_uring_detach();
+int  j_uring_buf_index(const void *ptr);
+
+// aligned I/O buffers (O_DIRECT)
+// 4 KiB aligned buffers whose capacity is len rounded up to a 4 KiB size class,
+// packed back to back in page spans with no headers. separate from the j_malloc heap.
+void  *j_iobuf_alloc(size_t len);
+void   j_iobuf_free(void *buf);
+size_t j_iobuf_size(const void *buf); // capacity of a buffer, 0 if not from the pool
+size_t j_iobuf_bytes();               // bytes mapped by the pool
+
+// reference-counted buffers and zero-copy slices
+// j_buf_alloc makes one j_malloc block with an inline atomic refcount and returns
+// a slice over all of it. every slice holds one reference; sub-slices share the
+// block, and releasing the last slice j_frees it. failures return a slice with data == NULL.
+typedef struct j_buf j_buf_t;
+
+typedef struct j_slice {
+    void *data;
+    size_t len;
+    j_buf_t *owner;
+} j_slice_t;
+
+j_slice_t j_buf_alloc(size_t len);
+j_slice_t j_slice_sub(j_slice_t s, size_t off, size_t len); // s[off, off + len), ERANGE if outside s
+j_slice_t j_slice_retain(j_slice_t s);                     // same view, one more reference
+void      j_slice_release(j_slice_t s);
+size_t    j_slice_refs(j_slice_t s);                       // current reference count
+
+// handles and cold compression
+// a handle owns a movable object: its address is only valid between
+// j_handle_lock and j_handle_unlock (locks nest). j_cold_sweep(idle_ms)
+// compresses the payload of every unlocked handle that has not been locked
+// for idle_ms (LZ4 block format, built in) into shared cold chunks and frees
+// the original; the next lock decompresses it into a new block, so the
+// address may change across an unlock. objects that would shrink by less
+// than 1/8 stay as they are. call j_cold_sweep from a maintenance timer.
+typedef struct j_handle *j_handle_t;
+
+j_handle_t j_handle_alloc(size_t size);   // NULL with errno = EINVAL for size 0, or ENOMEM
+void       j_handle_free(j_handle_t h);
+// NULL if a cold payload cannot be restored: errno = ENOMEM when there is no
+// block for it, EIO when its compressed copy is corrupt
+void      *j_handle_lock(j_handle_t h);
+void       j_handle_unlock(j_handle_t h);
+size_t     j_handle_size(j_handle_t h);
+size_t     j_cold_sweep(unsigned idle_ms); // returns how many handles it compressed
+
+typedef struct j_cold_stats {
+    size_t handles;
+    size_t cold_handles;   // compressed right now
+    size_t cold_raw_bytes; // their size uncompressed
+    size_t cold_bytes;     // their size compressed
+    size_t arena_bytes;    // cold chunk space held from the heap
+    double ratio;          // cold_raw_bytes / cold_bytes
+    unsigned long long compressions;
+    unsigned long long incompressible; // sweeps that left a payload as it was
+    unsigned long long locks;
+    unsigned long long cold_locks;     // locks that decompressed
+    unsigned long long cold_lock_ns_total;
+    unsigned long long cold_lock_ns_avg;
+    unsigned long long cold_lock_ns_max;
+} j_cold_stats_t;
+void j_cold_stats(j_cold_stats_t *out);
+
+// epoch-based deferred free (for lock-free data structures)
+// readers wrap accesses in j_epoch_enter/exit (nestable). j_free_deferred queues a
+// block on the calling thread; it is released through j_free_batch once every
+// thread has left the critical sections that could still see it.
+void j_epoch_enter();
+void j_epoch_exit();
+void j_free_deferred(void *ptr);
+void j_epoch_reclaim(); // try to release the calling thread's queued blocks now
+
+// asynchronous free
+// hands blocks to a background reclaimer thread (started on first use); the
+// caller only pays for a queue push. the reclaimer sorts each batch by address
+// and frees it through j_free_batch.
+void   j_free_async(void *ptr);
+void   j_free_async_batch(void **ptrs, size_t n);
+size_t j_free_async_flush(); // free everything queued so far on the calling thread, returns the count
+
+#ifdef __cplusplus
+}
+#endif
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,217 @@
+#ifndef JMALLOC_CORO_HPP
+#define JMALLOC_CORO_HPP
+
+// C++20 coroutine frame allocator backed by jmalloc
+// frames are recycled through thread-local, size-bucketed LIFO lists; a frame
+// destroyed on another thread goes back to its owner through a lock-free
+// remote-free list, drained by the owner when its local list runs dry.
+//
+// usage: derive the promise type from jmalloc::recycled_frame
+//   struct promise_type : jmalloc::recycled_frame { ... };
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include "jmalloc.h"
+
+namespace jmalloc {
+
+class coro_frame_allocator {
+public:
+    static constexpr std::size_t granule = 64;      // bucket width
+    static constexpr std::size_t buckets = 32;      // frames up to 2 KiB are recycled
+    static constexpr std::size_t max_cached = 256;  // frames kept per bucket and thread
+
+    static void* allocate(std::size_t n) {
+        std::size_t b = (n + granule - 1) / granule;
+        if (b == 0) b = 1;
+        if (b > buckets) return make_frame(n, nullptr, 0);
+        cache* cp = local();
+        // this thread's cache is already gone: hand out a frame nobody recycles
+        if (!cp) return make_frame(n, nullptr, 0);
+        cache& c = *cp;
+        std::uint32_t idx = static_cast<std::uint32_t>(b - 1);
+        node* f = c.free_list[idx];
+        if (!f) {
+            c.drain_remote();
+            f = c.free_list[idx];
+        }
+        if (f) {
+            c.free_list[idx] = f->next;
+            c.count[idx]--;
+            c.live++;
+            return f;
+        }
+        void* p = make_frame(b * granule, &c, idx);
+        if (p) c.live++;
+        return p;
+    }
+
+    static void deallocate(void* p, std::size_t) noexcept {
+        if (!p) return;
+        header* h = header_of(p);
+        cache* owner = h->owner;
+        if (!owner) {
+            j_free(h->block);
+            return;
+        }
+        cache* self = tls_cache;
+        if (owner == self) {
+            self->live--;
+            self->put_local(static_cast<node*>(p), h->bucket);
+            return;
+        }
+        owner->push_remote(static_cast<node*>(p));
+    }
+
+private:
+    struct cache;
+
+    // sits right in front of every frame; 32 bytes keeps the frame 16-aligned
+    struct alignas(16) header {
+        void* block;          // what j_malloc_multi returned, for j_free
+        cache* owner;         // recycling thread, nullptr for oversized frames
+        std::uint32_t bucket;
+        std::uint32_t pad;
+        std::uint64_t pad2;
+    };
+    static_assert(sizeof(header) == 32, "frame header must keep 16-byte alignment");
+
+    struct node { node* next; };
+
+    static header* header_of(void* frame) {
+        return reinterpret_cast<header*>(static_cast<char*>(frame) - sizeof(header));
+    }
+
+    // remote list value meaning "owner thread has exited"
+    static node* closed() { return reinterpret_cast<node*>(std::uintptr_t(1)); }
+
+    struct cache {
+        node* free_list[buckets] = {};
+        std::size_t count[buckets] = {};
+        std::size_t live = 0;                     // frames handed out and not yet back (owner view)
+        std::atomic<node*> remote{nullptr};       // frames freed by other threads
+        std::atomic<std::size_t> orphan_live{0};  // outstanding frames once the owner is gone
+
+        void put_local(node* f, std::uint32_t idx) {
+            if (count[idx] >= max_cached) {
+                j_free(header_of(f)->block);
+                return;
+            }
+            f->next = free_list[idx];
+            free_list[idx] = f;
+            count[idx]++;
+        }
+
+        void push_remote(node* f) {
+            node* head = remote.load(std::memory_order_relaxed);
+            for (;;) {
+                if (head == closed()) {
+                    // owner is gone: free directly, the last one out frees the cache
+                    j_free(header_of(f)->block);
+                    if (orphan_live.fetch_sub(1, std::memory_order_acq_rel) == 1) destroy(this);
+                    return;
+                }
+                f->next = head;
+                if (remote.compare_exchange_weak(head, f, std::memory_order_release, std::memory_order_relaxed)) return;
+            }
+        }
+
+        void drain_remote() {
+            node* f = remote.exchange(nullptr, std::memory_order_acquire);
+            while (f) {
+                node* next = f->next;
+                live--;
+                put_local(f, header_of(f)->bucket);
+                f = next;
+            }
+        }
+
+        // thread exit: return cached frames and close the remote list
+        void retire() {
+            drain_remote();
+            for (std::size_t i = 0; i < buckets; ++i) {
+                node* f = free_list[i];
+                while (f) {
+                    node* next = f->next;
+                    j_free(header_of(f)->block);
+                    f = next;
+                }
+                free_list[i] = nullptr;
+                count[i] = 0;
+            }
+            orphan_live.store(live, std::memory_order_release);
+            // frames pushed between the drain and the close are already counted in live
+            node* late = remote.exchange(closed(), std::memory_order_acq_rel);
+            std::size_t n = 0;
+            while (late) {
+                node* next = late->next;
+                j_free(header_of(late)->block);
+                n++;
+                late = next;
+            }
+            if (orphan_live.fetch_sub(n, std::memory_order_acq_rel) == n) destroy(this);
+        }
+    };
+
+    static void destroy(cache* c) {
+        c->~cache();
+        j_free(c);
+    }
+
+    // retire() may destroy the cache, so it is unhooked from the thread first:
+    // frames freed later on this thread (say, by another thread_local's
+    // destructor) then go through push_remote, which knows the list is closed
+    struct cache_owner {
+        cache* c;
+        cache_owner() noexcept : c(nullptr) {}
+        ~cache_owner() {
+            cache* dying = c;
+            c = nullptr;
+            tls_cache = nullptr;
+            tls_shutdown = true;
+            if (dying) dying->retire();
+        }
+    };
+
+    static inline thread_local cache* tls_cache = nullptr;
+    static inline thread_local bool tls_shutdown = false;
+    static inline thread_local cache_owner tls_owner;
+
+    // the calling thread's cache, or nullptr once its thread_locals are being
+    // destroyed (a new cache then would never be retired)
+    static cache* local() {
+        cache* c = tls_cache;
+        if (c || tls_shutdown) return c;
+        void* mem = j_malloc(sizeof(cache));
+        if (!mem) throw std::bad_alloc();
+        c = new (mem) cache();
+        tls_cache = c;
+        tls_owner.c = c;
+        return c;
+    }
+
+    static void* make_frame(std::size_t n, cache* owner, std::uint32_t bucket) {
+        std::size_t sizes[1] = { sizeof(header) + n };
+        std::size_t aligns[1] = { alignof(header) };
+        void* part[1];
+        void* block = j_malloc_multi(sizes, aligns, 1, part);
+        if (!block) throw std::bad_alloc();
+        header* h = static_cast<header*>(part[0]);
+        h->block = block;
+        h->owner = owner;
+        h->bucket = bucket;
+        return h + 1;
+    }
+};
+
+// promise mixin: routes the coroutine frame through coro_frame_allocator
+struct recycled_frame {
+    static void* operator new(std::size_t n) { return coro_frame_allocator::allocate(n); }
+    static void operator delete(void* p, std::size_t n) noexcept { coro_frame_allocator::deallocate(p, n); }
+};
+
+} // namespace jmalloc
+
+#endif
@@ -0,0 +1,60 @@
+#include "jmalloc.h"
+
+#include <stdint.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+// reference-counted buffers on top of j_malloc
+// [j_buf: refs | cap][data ...] is one j_malloc block, so buffers use the
+// heap's normal placement and the last release is a single j_free
+struct j_buf {
+    _Atomic size_t refs;
+    size_t cap; // bytes of data after the header
+};
+
+// keep the data as aligned as the heap's own payloads
+#define JBUF_HEADER ((sizeof(struct j_buf) + 7u) & ~(size_t)7u)
+
+static inline uint8_t* buf_data(j_buf_t *b) {
+    return (uint8_t*)b + JBUF_HEADER;
+}
+
+static const j_slice_t k_empty = { NULL, 0, NULL };
+
+j_slice_t j_buf_alloc(size_t len) {
+    if (len == 0) return k_empty;
+    j_buf_t *b = (j_buf_t*)j_malloc(JBUF_HEADER + len);
+    if (!b) return k_empty;
+    atomic_init(&b->refs, 1);
+    b->cap = len;
+    j_slice_t s = { buf_data(b), len, b };
+    return s;
+}
+
+j_slice_t j_slice_sub(j_slice_t s, size_t off, size_t len) {
+    // a view may only narrow the one it came from
+    if (!s.owner || off > s.len || len > s.len - off) {
+        errno = ERANGE;
+        return k_empty;
+    }
+    atomic_fetch_add_explicit(&s.owner->refs, 1, memory_order_relaxed);
+    j_slice_t sub = { (uint8_t*)s.data + off, len, s.owner };
+    return sub;
+}
+
+j_slice_t j_slice_retain(j_slice_t s) {
+    if (s.owner) atomic_fetch_add_explicit(&s.owner->refs, 1, memory_order_relaxed);
+    return s;
+}
+
+void j_slice_release(j_slice_t s) {
+    if (!s.owner) return;
+    // acq_rel: the last owner must see every other owner's writes before freeing
+    if (atomic_fetch_sub_explicit(&s.owner->refs, 1, memory_order_acq_rel) == 1) {
+        j_free(s.owner);
+    }
+}
+
+size_t j_slice_refs(j_slice_t s) {
+    return s.owner ? atomic_load_explicit(&s.owner->refs, memory_order_relaxed) : 0;
+}
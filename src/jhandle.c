@@ -0,0 +1,390 @@
+// expose clock_gettime under -std=c11
+#define _DEFAULT_SOURCE
+#include "jmalloc.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+// movable objects behind handles, and cold compression on top of them
+// a handle is a small record that owns its object's storage. code touches the
+// payload only between j_handle_lock and j_handle_unlock, so while a handle is
+// unlocked its payload may live somewhere else: j_cold_sweep packs the payloads
+// of handles left unlocked long enough, compressed, into shared cold chunks and
+// frees the originals; the next lock decompresses into a fresh j_malloc block.
+// one mutex guards the registry, the chunks and the counters.
+
+#if defined(_WIN32)
+    #include <windows.h>
+    typedef SRWLOCK hmutex_t;
+    #define HMUTEX_INIT SRWLOCK_INIT
+    static void hmutex_lock(hmutex_t *m) { AcquireSRWLockExclusive(m); }
+    static void hmutex_unlock(hmutex_t *m) { ReleaseSRWLockExclusive(m); }
+    static unsigned long long now_ns(void) {
+        LARGE_INTEGER f, c;
+        QueryPerformanceFrequency(&f);
+        QueryPerformanceCounter(&c);
+        unsigned long long q = (unsigned long long)f.QuadPart, t = (unsigned long long)c.QuadPart;
+        return t / q * 1000000000ull + t % q * 1000000000ull / q;
+    }
+#else
+    #include <pthread.h>
+    #include <time.h>
+    typedef pthread_mutex_t hmutex_t;
+    #define HMUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+    static void hmutex_lock(hmutex_t *m) { pthread_mutex_lock(m); }
+    static void hmutex_unlock(hmutex_t *m) { pthread_mutex_unlock(m); }
+    static unsigned long long now_ns(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+    }
+#endif
+
+// compression
+// the LZ4 block format: every sequence is a token (literal length << 4 | match
+// length - 4), extra length bytes for either nibble at 15, the literals, and a
+// 2-byte little-endian match offset; the last sequence is literals only and
+// covers at least the final 5 bytes. greedy matching through a hash of 4-byte
+// prefixes (up to 4096 entries, fewer for small inputs so clearing it stays
+// cheap), skipping faster through data that does not match.
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_LAST_LITERALS 5
+#define LZ_MFLIMIT 12 // no match starts in the last 12 bytes
+#define LZ_MAX_OFFSET 65535
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline unsigned lz_hash(uint32_t v, unsigned bits) {
+    return (v * 2654435761u) >> (32 - bits);
+}
+
+static uint8_t* lz_put_len(uint8_t *op, size_t len) {
+    for (; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// one sequence; match_len 0 for the closing literals-only one. NULL if it does not fit
+static uint8_t* lz_put_seq(uint8_t *op, uint8_t *oend, const uint8_t *lit, size_t lit_len, size_t dist, size_t match_len) {
+    size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+    if ((size_t)(oend - op) < 1 + lit_len / 255 + 1 + lit_len + 2 + ml / 255 + 1) return NULL;
+    uint8_t *token = op++;
+    *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+    if (lit_len >= 15) op = lz_put_len(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (!match_len) return op;
+    *op++ = (uint8_t)dist;
+    *op++ = (uint8_t)(dist >> 8);
+    *token |= (uint8_t)(ml >= 15 ? 15 : ml);
+    if (ml >= 15) op = lz_put_len(op, ml - 15);
+    return op;
+}
+
+// compressed size, or 0 if it would not fit in cap
+static size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    if (n > UINT32_MAX - 1) return 0;
+    unsigned bits = 8;
+    while (bits < LZ_HASH_BITS && (1u << bits) < n / 2) bits++;
+    uint32_t table[1u << LZ_HASH_BITS]; // position + 1, 0 = empty
+    memset(table, 0, sizeof(uint32_t) << bits);
+    const uint8_t *ip = src, *anchor = src, *end = src + n;
+    const uint8_t *mflimit = n > LZ_MFLIMIT ? end - LZ_MFLIMIT : src;
+    uint8_t *op = dst, *oend = dst + cap;
+    unsigned misses = 0;
+    while (ip < mflimit) {
+        unsigned slot = lz_hash(read32(ip), bits);
+        const uint8_t *ref = table[slot] ? src + table[slot] - 1 : NULL;
+        table[slot] = (uint32_t)(ip - src) + 1;
+        if (!ref || ip - ref > LZ_MAX_OFFSET || read32(ref) != read32(ip)) {
+            ip += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+        size_t len = LZ_MIN_MATCH;
+        while (ip + len < end - LZ_LAST_LITERALS && ref[len] == ip[len]) len++;
+        op = lz_put_seq(op, oend, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), len);
+        if (!op) return 0;
+        ip += len;
+        anchor = ip;
+    }
+    op = lz_put_seq(op, oend, anchor, (size_t)(end - anchor), 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+// 0 if src decodes to exactly out_n bytes, -1 if it is malformed
+static int lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t out_n) {
+    const uint8_t *ip = src, *iend = src + n;
+    uint8_t *op = dst, *oend = dst + out_n;
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            unsigned b;
+            do {
+                if (ip == iend) return -1;
+                lit += b = *ip++;
+            } while (b == 255);
+        }
+        if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit) return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) break; // the closing sequence has no match
+        if (iend - ip < 2) return -1;
+        size_t dist = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (dist == 0 || dist > (size_t)(op - dst)) return -1;
+        size_t len = token & 15;
+        if (len == 15) {
+            unsigned b;
+            do {
+                if (ip == iend) return -1;
+                len += b = *ip++;
+            } while (b == 255);
+        }
+        len += LZ_MIN_MATCH;
+        if ((size_t)(oend - op) < len) return -1;
+        const uint8_t *ref = op - dist;
+        if (dist >= len) {
+            memcpy(op, ref, len);
+        } else {
+            // overlapping: the match repeats the last dist bytes
+            for (size_t i = 0; i < len; ++i) op[i] = ref[i];
+        }
+        op += len;
+    }
+    return op == oend ? 0 : -1;
+}
+
+// cold chunks
+// compressed payloads are appended back to back into COLD_CHUNK-sized j_malloc
+// blocks; the newest chunk is the one being filled. a chunk goes back to the
+// heap when its last payload is decompressed or freed, and sweeps move the
+// survivors out of chunks that are mostly dead.
+#define COLD_CHUNK (256u << 10)
+
+typedef struct cold_chunk {
+    struct cold_chunk *next;
+    struct cold_chunk *prev;
+    size_t cap;  // bytes of payload space
+    size_t used; // appended so far
+    size_t live; // still referenced by a handle
+} cold_chunk_t;
+
+#define CHUNK_HEADER ((sizeof(cold_chunk_t) + 7u) & ~(size_t)7u)
+
+struct j_handle {
+    void *data; // resident payload, NULL while cold
+    size_t size;
+    unsigned locks;
+    unsigned long long idle_since; // now_ns() at the last unlock
+    // the compressed copy while cold
+    cold_chunk_t *chunk;
+    size_t off;
+    size_t clen;
+    // registry
+    struct j_handle *next;
+    struct j_handle *prev;
+};
+
+static hmutex_t g_lock = HMUTEX_INIT;
+static struct j_handle *g_handles = NULL;
+static cold_chunk_t *g_chunks = NULL; // newest first
+static j_cold_stats_t g_stats;        // everything but the derived fields
+
+static inline uint8_t* chunk_data(cold_chunk_t *c) {
+    return (uint8_t*)c + CHUNK_HEADER;
+}
+
+// append n bytes, opening a new chunk when the newest one is full. 0 or -1
+static int cold_store(struct j_handle *h, const uint8_t *src, size_t n) {
+    cold_chunk_t *c = g_chunks;
+    if (!c || c->cap - c->used < n) {
+        size_t cap = n > COLD_CHUNK ? n : COLD_CHUNK;
+        c = (cold_chunk_t*)j_malloc(CHUNK_HEADER + cap);
+        if (!c) return -1;
+        c->cap = cap;
+        c->used = c->live = 0;
+        c->prev = NULL;
+        c->next = g_chunks;
+        if (g_chunks) g_chunks->prev = c;
+        g_chunks = c;
+        g_stats.arena_bytes += cap;
+    }
+    memcpy(chunk_data(c) + c->used, src, n);
+    h->chunk = c;
+    h->off = c->used;
+    h->clen = n;
+    c->used += n;
+    c->live += n;
+    return 0;
+}
+
+// drop a compressed copy; an emptied chunk goes back to the heap
+static void cold_release(cold_chunk_t *c, size_t clen) {
+    c->live -= clen;
+    if (c->live) return;
+    if (c->prev) c->prev->next = c->next;
+    else g_chunks = c->next;
+    if (c->next) c->next->prev = c->prev;
+    g_stats.arena_bytes -= c->cap;
+    j_free(c);
+}
+
+static void registry_unlink(struct j_handle *h) {
+    if (h->prev) h->prev->next = h->next;
+    else g_handles = h->next;
+    if (h->next) h->next->prev = h->prev;
+    g_stats.handles--;
+}
+
+j_handle_t j_handle_alloc(size_t size) {
+    if (size == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    struct j_handle *h = (struct j_handle*)j_malloc(sizeof(struct j_handle));
+    if (!h) return NULL;
+    h->data = j_malloc(size);
+    if (!h->data) {
+        j_free(h);
+        return NULL;
+    }
+    h->size = size;
+    h->locks = 0;
+    h->idle_since = now_ns();
+    h->chunk = NULL;
+    h->off = h->clen = 0;
+    hmutex_lock(&g_lock);
+    h->prev = NULL;
+    h->next = g_handles;
+    if (g_handles) g_handles->prev = h;
+    g_handles = h;
+    g_stats.handles++;
+    hmutex_unlock(&g_lock);
+    return h;
+}
+
+void j_handle_free(j_handle_t h) {
+    if (!h) return;
+    hmutex_lock(&g_lock);
+    registry_unlink(h);
+    if (h->chunk) {
+        g_stats.cold_handles--;
+        g_stats.cold_raw_bytes -= h->size;
+        g_stats.cold_bytes -= h->clen;
+        cold_release(h->chunk, h->clen);
+    }
+    hmutex_unlock(&g_lock);
+    j_free(h->data);
+    j_free(h);
+}
+
+size_t j_handle_size(j_handle_t h) {
+    return h ? h->size : 0;
+}
+
+void *j_handle_lock(j_handle_t h) {
+    hmutex_lock(&g_lock);
+    if (!h->data) {
+        unsigned long long t0 = now_ns();
+        uint8_t *p = (uint8_t*)j_malloc(h->size);
+        if (!p) {
+            hmutex_unlock(&g_lock);
+            errno = ENOMEM;
+            return NULL;
+        }
+        if (lz_decompress(chunk_data(h->chunk) + h->off, h->clen, p, h->size) != 0) {
+            hmutex_unlock(&g_lock);
+            j_free(p);
+            errno = EIO;
+            return NULL;
+        }
+        g_stats.cold_handles--;
+        g_stats.cold_raw_bytes -= h->size;
+        g_stats.cold_bytes -= h->clen;
+        cold_release(h->chunk, h->clen);
+        h->chunk = NULL;
+        h->data = p;
+        unsigned long long ns = now_ns() - t0;
+        g_stats.cold_locks++;
+        g_stats.cold_lock_ns_total += ns;
+        if (ns > g_stats.cold_lock_ns_max) g_stats.cold_lock_ns_max = ns;
+    }
+    h->locks++;
+    g_stats.locks++;
+    void *p = h->data;
+    hmutex_unlock(&g_lock);
+    return p;
+}
+
+void j_handle_unlock(j_handle_t h) {
+    unsigned long long now = now_ns();
+    hmutex_lock(&g_lock);
+    if (h->locks && --h->locks == 0) h->idle_since = now;
+    hmutex_unlock(&g_lock);
+}
+
+// grow a sweep's scratch buffer (compression output, before it is placed) to n bytes. 0 or -1
+static int scratch_reserve(uint8_t **buf, size_t *cap, size_t n) {
+    if (n <= *cap) return 0;
+    uint8_t *s = (uint8_t*)j_realloc(*buf, n);
+    if (!s) return -1;
+    *buf = s;
+    *cap = n;
+    return 0;
+}
+
+size_t j_cold_sweep(unsigned idle_ms) {
+    unsigned long long now = now_ns(), idle = (unsigned long long)idle_ms * 1000000ull;
+    size_t n = 0, scratch_cap = 0;
+    uint8_t *scratch = NULL;
+    hmutex_lock(&g_lock);
+    for (struct j_handle *h = g_handles; h; h = h->next) {
+        if (h->locks || !h->data || now - h->idle_since < idle) continue;
+        if (scratch_reserve(&scratch, &scratch_cap, LZ_BOUND(h->size)) != 0) break;
+        size_t clen = lz_compress((const uint8_t*)h->data, h->size, scratch, scratch_cap);
+        // not worth a decompression on the next lock: look again after another idle period
+        if (clen == 0 || clen > h->size - h->size / 8) {
+            h->idle_since = now;
+            g_stats.incompressible++;
+            continue;
+        }
+        if (cold_store(h, scratch, clen) != 0) break;
+        j_free(h->data);
+        h->data = NULL;
+        g_stats.compressions++;
+        g_stats.cold_handles++;
+        g_stats.cold_raw_bytes += h->size;
+        g_stats.cold_bytes += clen;
+        n++;
+    }
+    // repack payloads out of chunks that are less than a quarter live
+    for (struct j_handle *h = g_handles; h; h = h->next) {
+        cold_chunk_t *c = h->chunk;
+        if (!c || c == g_chunks || c->live * 4 >= c->used) continue;
+        // h keeps its old copy if there is no room for the new one
+        size_t clen = h->clen;
+        if (cold_store(h, chunk_data(c) + h->off, clen) != 0) break;
+        cold_release(c, clen);
+    }
+    hmutex_unlock(&g_lock);
+    j_free(scratch);
+    return n;
+}
+
+void j_cold_stats(j_cold_stats_t *out) {
+    hmutex_lock(&g_lock);
+    *out = g_stats;
+    hmutex_unlock(&g_lock);
+    out->ratio = out->cold_bytes ? (double)out->cold_raw_bytes / (double)out->cold_bytes : 0.0;
+    out->cold_lock_ns_avg = out->cold_locks ? out->cold_lock_ns_total / out->cold_locks : 0;
+}
@@ -1,9 +1,22 @@
+// expose MAP_ANONYMOUS and friends under -std=c11
+#define _DEFAULT_SOURCE
 #include "jmalloc.h"
 
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+// core callback run by the platform layer when a thread exits
+static void thread_state_release(void *arg);
+
+// a page-aligned range for os_purge_vec
+typedef struct os_range {
+    void *p;
+    size_t n;
+} os_range_t;
 
 // platform abstraction
 #if defined(_WIN32)
@@ -35,10 +48,108 @@
         // VirtualFree(memory_address, size (0 means free the entire region), free_type)
         return VirtualFree(p, 0, MEM_RELEASE) ? 0 : -1;
     }
+    // give the physical pages of a page-aligned range back; the range stays mapped
+    static int os_purge(void* p, size_t n) {
+        // MEM_RESET tells the OS the contents are no longer needed
+        return VirtualAlloc(p, n, MEM_RESET, PAGE_READWRITE) ? 0 : -1;
+    }
+    // purge many ranges; *calls counts the system calls made. 0, or -1 if any range failed
+    static int os_purge_vec(const os_range_t* r, size_t n, unsigned long long* calls) {
+        int rc = 0;
+        for (size_t i = 0; i < n; ++i, ++*calls) {
+            if (os_purge(r[i].p, r[i].n) != 0) rc = -1;
+        }
+        return rc;
+    }
+    static int os_purge_vec_batched(void) { return 0; }
+    // reset pages keep whatever they held or come back undefined, never zeroed
+    #define OS_PURGE_ZEROES 0
+    // monotonic clock in milliseconds
+    static unsigned long long os_now_ms(void) {
+        return (unsigned long long)GetTickCount64();
+    }
+    // io_uring is Linux only
+    static int os_uring_register_table(int fd, unsigned nr) { (void)fd; (void)nr; errno = ENOSYS; return -1; }
+    static int os_uring_update(int fd, unsigned slot, void* p, size_t n) { (void)fd; (void)slot; (void)p; (void)n; errno = ENOSYS; return -1; }
+    static int os_uring_unregister(int fd) { (void)fd; errno = ENOSYS; return -1; }
+    // slim reader/writer lock used as a plain mutex
+    typedef SRWLOCK os_mutex_t;
+    #define OS_MUTEX_INIT SRWLOCK_INIT
+    static void os_mutex_lock(os_mutex_t* m) { AcquireSRWLockExclusive(m); }
+    static void os_mutex_unlock(os_mutex_t* m) { ReleaseSRWLockExclusive(m); }
+    static void os_yield(void) { SwitchToThread(); }
+    // fiber local storage callbacks also fire on thread exit
+    static DWORD g_fls_key = FLS_OUT_OF_INDEXES;
+    static INIT_ONCE g_fls_once = INIT_ONCE_STATIC_INIT;
+    static void NTAPI os_fls_cb(void* arg) {
+        if (arg) thread_state_release(arg);
+    }
+    static BOOL CALLBACK os_fls_init(PINIT_ONCE once, PVOID param, PVOID* ctx) {
+        (void)once; (void)param; (void)ctx;
+        g_fls_key = FlsAlloc(os_fls_cb);
+        return TRUE;
+    }
+    // call thread_state_release(arg) when the calling thread exits
+    static void os_on_thread_exit(void* arg) {
+        InitOnceExecuteOnce(&g_fls_once, os_fls_init, NULL, NULL);
+        if (g_fls_key != FLS_OUT_OF_INDEXES) FlsSetValue(g_fls_key, arg);
+    }
+    // condition variable paired with os_mutex_t
+    typedef CONDITION_VARIABLE os_cond_t;
+    #define OS_COND_INIT CONDITION_VARIABLE_INIT
+    static void os_cond_signal(os_cond_t* c) { WakeConditionVariable(c); }
+    static void os_cond_wait_ms(os_cond_t* c, os_mutex_t* m, unsigned ms) {
+        SleepConditionVariableSRW(c, m, ms, 0);
+    }
+    // detached background thread
+    static void (*g_os_thread_fn)(void);
+    static DWORD WINAPI os_thread_tramp(LPVOID arg) { (void)arg; g_os_thread_fn(); return 0; }
+    static int os_thread_start(void (*fn)(void)) {
+        g_os_thread_fn = fn;
+        HANDLE h = CreateThread(NULL, 0, os_thread_tramp, NULL, 0, NULL);
+        if (!h) return -1;
+        CloseHandle(h);
+        return 0;
+    }
+    // the calling thread's OS-level name; left empty here (GetThreadDescription
+    // needs Windows 10 and hands back a heap string)
+    static void os_thread_name(char* buf, size_t n) { if (n) buf[0] = 0; }
+    // crash dumps: CRT file descriptors and signal() handlers
+    #include <io.h>
+    #include <fcntl.h>
+    #include <signal.h>
+    #include <sys/stat.h>
+    static int os_getpid(void) { return (int)GetCurrentProcessId(); }
+    static int os_dump_open(const char* path) {
+        return _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+    }
+    static void os_dump_write(int fd, const void* p, size_t n) { _write(fd, p, (unsigned)n); }
+    static void os_dump_close(int fd) { _close(fd); }
+    static const int k_os_crash_signals[] = { SIGSEGV, SIGILL, SIGFPE, SIGABRT };
+    #define OS_CRASH_SIGNALS (sizeof(k_os_crash_signals) / sizeof(k_os_crash_signals[0]))
+    static void os_crash_handlers_install(void (*fn)(int)) {
+        for (size_t i = 0; i < OS_CRASH_SIGNALS; ++i) signal(k_os_crash_signals[i], fn);
+    }
+    // the CRT resets a handler before calling it; raising again terminates
+    static void os_crash_reraise(int sig) {
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
     // if not windows (linux, macos, etc)
     #else
     #include <unistd.h>
     #include <sys/mman.h>
+    #include <pthread.h>
+    #include <sched.h>
+    #include <time.h>
+    #include <fcntl.h>
+    #include <signal.h>
+    #if defined(__linux__)
+        #include <linux/io_uring.h>
+        #include <sys/syscall.h>
+        #include <sys/uio.h>
+        #include <sys/prctl.h>
+    #endif
     static size_t os_pagesize() {
         long ps = sysconf(_SC_PAGESIZE);
         // linux returns -1 on error
@@ -57,6 +168,211 @@
         size_t need = (n + ps - 1) & ~(ps - 1);
         return munmap(p, need);
     }
+    // give the physical pages of a page-aligned range back; the range stays mapped
+    static int os_purge(void* p, size_t n) {
+        // anonymous private pages read back as zero after MADV_DONTNEED
+        return madvise(p, n, MADV_DONTNEED);
+    }
+    // process_madvise (Linux 5.10) takes an iovec of ranges per call, but only
+    // newer kernels accept MADV_DONTNEED through it, so the first call probes:
+    // 0 = untried, 1 = works, -1 = fall back to one madvise per range
+    #if defined(__linux__) && defined(SYS_process_madvise) && defined(SYS_pidfd_open)
+        #define OS_IOV_MAX 512
+        static _Atomic int g_pmadv_state = 0;
+        static _Atomic int g_pmadv_pidfd = -1;
+        static int os_self_pidfd(void) {
+            int fd = atomic_load_explicit(&g_pmadv_pidfd, memory_order_acquire);
+            if (fd >= 0) return fd;
+            int mine = (int)syscall(SYS_pidfd_open, getpid(), 0u);
+            if (mine < 0) return -1;
+            if (!atomic_compare_exchange_strong(&g_pmadv_pidfd, &fd, mine)) {
+                close(mine); // another thread got there first
+                return fd;
+            }
+            return mine;
+        }
+    #endif
+    // purge many ranges; *calls counts the system calls made. 0, or -1 if any range failed
+    static int os_purge_vec(const os_range_t* r, size_t n, unsigned long long* calls) {
+        int rc = 0;
+        size_t i = 0;
+    #if defined(__linux__) && defined(SYS_process_madvise) && defined(SYS_pidfd_open)
+        int pidfd = atomic_load_explicit(&g_pmadv_state, memory_order_relaxed) >= 0 ? os_self_pidfd() : -1;
+        if (pidfd < 0) atomic_store_explicit(&g_pmadv_state, -1, memory_order_relaxed);
+        while (i < n && pidfd >= 0) {
+            struct iovec iov[OS_IOV_MAX];
+            size_t k = 0, want = 0;
+            for (; k < OS_IOV_MAX && i + k < n; ++k) {
+                iov[k].iov_base = r[i + k].p;
+                iov[k].iov_len = r[i + k].n;
+                want += r[i + k].n;
+            }
+            ++*calls;
+            long done = (long)syscall(SYS_process_madvise, pidfd, iov, k, MADV_DONTNEED, 0u);
+            if (done < 0) {
+                // unsupported advice or kernel: madvise the rest one range at a time
+                atomic_store_explicit(&g_pmadv_state, -1, memory_order_relaxed);
+                break;
+            }
+            atomic_store_explicit(&g_pmadv_state, 1, memory_order_relaxed);
+            if ((size_t)done == want) {
+                i += k;
+                continue;
+            }
+            // stopped part way: skip what was done, finish the range it stopped in
+            size_t left = (size_t)done;
+            while (left >= r[i].n) left -= r[i++].n;
+            ++*calls;
+            if (madvise((char*)r[i].p + left, r[i].n - left, MADV_DONTNEED) != 0) rc = -1;
+            i++;
+        }
+    #endif
+        for (; i < n; ++i, ++*calls) {
+            if (os_purge(r[i].p, r[i].n) != 0) rc = -1;
+        }
+        return rc;
+    }
+    // 1 once os_purge_vec has purged through process_madvise
+    static int os_purge_vec_batched(void) {
+    #if defined(__linux__) && defined(SYS_process_madvise) && defined(SYS_pidfd_open)
+        return atomic_load_explicit(&g_pmadv_state, memory_order_relaxed) == 1;
+    #else
+        return 0;
+    #endif
+    }
+    // only Linux promises zero-filled pages after MADV_DONTNEED
+    #if defined(__linux__)
+        #define OS_PURGE_ZEROES 1
+    #else
+        #define OS_PURGE_ZEROES 0
+    #endif
+    // monotonic clock in milliseconds
+    static unsigned long long os_now_ms(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long long)ts.tv_sec * 1000u + (unsigned long long)ts.tv_nsec / 1000000u;
+    }
+    #if defined(__linux__)
+    // create an empty (sparse) fixed-buffer table of nr slots on the ring
+    static int os_uring_register_table(int fd, unsigned nr) {
+        struct io_uring_rsrc_register r;
+        memset(&r, 0, sizeof(r));
+        r.nr = nr;
+        r.flags = IORING_RSRC_REGISTER_SPARSE;
+        return (int)syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS2, &r, sizeof(r));
+    }
+    // point one slot at [p, p + n), or empty it with p = NULL, n = 0
+    static int os_uring_update(int fd, unsigned slot, void* p, size_t n) {
+        struct iovec iov = { p, n };
+        struct io_uring_rsrc_update2 u;
+        memset(&u, 0, sizeof(u));
+        u.offset = slot;
+        u.data = (unsigned long long)(uintptr_t)&iov;
+        u.nr = 1;
+        int rc = (int)syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS_UPDATE, &u, sizeof(u));
+        // the update call returns the number of slots updated
+        return rc == 1 ? 0 : -1;
+    }
+    static int os_uring_unregister(int fd) {
+        return (int)syscall(__NR_io_uring_register, fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    }
+    #else
+    static int os_uring_register_table(int fd, unsigned nr) { (void)fd; (void)nr; errno = ENOSYS; return -1; }
+    static int os_uring_update(int fd, unsigned slot, void* p, size_t n) { (void)fd; (void)slot; (void)p; (void)n; errno = ENOSYS; return -1; }
+    static int os_uring_unregister(int fd) { (void)fd; errno = ENOSYS; return -1; }
+    #endif
+    typedef pthread_mutex_t os_mutex_t;
+    #define OS_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+    static void os_mutex_lock(os_mutex_t* m) { pthread_mutex_lock(m); }
+    static void os_mutex_unlock(os_mutex_t* m) { pthread_mutex_unlock(m); }
+    static void os_yield(void) { sched_yield(); }
+    // a pthread key destructor fires on thread exit for non-NULL values
+    static pthread_key_t g_exit_key;
+    static pthread_once_t g_exit_once = PTHREAD_ONCE_INIT;
+    static void os_exit_key_init(void) {
+        pthread_key_create(&g_exit_key, thread_state_release);
+    }
+    // call thread_state_release(arg) when the calling thread exits
+    static void os_on_thread_exit(void* arg) {
+        pthread_once(&g_exit_once, os_exit_key_init);
+        pthread_setspecific(g_exit_key, arg);
+    }
+    // condition variable paired with os_mutex_t
+    typedef pthread_cond_t os_cond_t;
+    #define OS_COND_INIT PTHREAD_COND_INITIALIZER
+    static void os_cond_signal(os_cond_t* c) { pthread_cond_signal(c); }
+    static void os_cond_wait_ms(os_cond_t* c, os_mutex_t* m, unsigned ms) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ms / 1000u;
+        ts.tv_nsec += (long)(ms % 1000u) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(c, m, &ts);
+    }
+    // detached background thread
+    static void (*g_os_thread_fn)(void);
+    static void* os_thread_tramp(void* arg) { (void)arg; g_os_thread_fn(); return NULL; }
+    static int os_thread_start(void (*fn)(void)) {
+        pthread_t t;
+        g_os_thread_fn = fn;
+        if (pthread_create(&t, NULL, os_thread_tramp, NULL) != 0) return -1;
+        pthread_detach(t);
+        return 0;
+    }
+    // the calling thread's OS-level name (pthread_setname_np / prctl), if any
+    static void os_thread_name(char* buf, size_t n) {
+        if (!n) return;
+        buf[0] = 0;
+    #if defined(__linux__)
+        char comm[16] = {0}; // PR_GET_NAME writes up to 16 bytes
+        if (prctl(PR_GET_NAME, comm, 0, 0, 0) == 0) {
+            size_t len = strnlen(comm, sizeof(comm));
+            if (len >= n) len = n - 1;
+            memcpy(buf, comm, len);
+            buf[len] = 0;
+        }
+    #endif
+    }
+    // crash dumps: everything below is async-signal-safe
+    static int os_getpid(void) { return (int)getpid(); }
+    static int os_dump_open(const char* path) {
+        return open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    }
+    static void os_dump_write(int fd, const void* p, size_t n) {
+        const char* c = (const char*)p;
+        while (n) {
+            ssize_t w = write(fd, c, n);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return;
+            c += w;
+            n -= (size_t)w;
+        }
+    }
+    static void os_dump_close(int fd) { close(fd); }
+    static const int k_os_crash_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+    #define OS_CRASH_SIGNALS (sizeof(k_os_crash_signals) / sizeof(k_os_crash_signals[0]))
+    static struct sigaction g_os_prev_action[OS_CRASH_SIGNALS];
+    // fn runs once per process for the first crash signal; the previous actions
+    // are kept so the signal can be passed on
+    static void os_crash_handlers_install(void (*fn)(int)) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = fn;
+        sigemptyset(&sa.sa_mask);
+        for (size_t i = 0; i < OS_CRASH_SIGNALS; ++i) sigaction(k_os_crash_signals[i], &sa, &g_os_prev_action[i]);
+    }
+    // put back whatever handled sig before (normally the default action, which
+    // writes the core) and raise it again; it is delivered once the handler
+    // returns, and a fault re-executes its instruction anyway
+    static void os_crash_reraise(int sig) {
+        for (size_t i = 0; i < OS_CRASH_SIGNALS; ++i) {
+            if (k_os_crash_signals[i] == sig) sigaction(sig, &g_os_prev_action[i], NULL);
+        }
+        raise(sig);
+    }
 #endif
 
 // allocator core11
@@ -67,12 +383,518 @@
 // To reduce OS calls, request memory by arenas (>= 1 MiB)
 #define ARENA_MIN_SIZE (1u << 20) // 1 MiB
 
-static arena_header_t *g_arenas = NULL;
-static block_header_t *g_head = NULL; // global block list (across arenas)
-static block_header_t *g_tail = NULL;
+// a heap is a set of arenas threaded by one block list. heap 0 serves every
+// allocation unless call-site groups are on, then each group has its own heap.
+typedef struct heap {
+    arena_header_t *arenas;
+    block_header_t *head; // block list (across this heap's arenas)
+    block_header_t *tail;
+    block_header_t *rover;       // next-fit position
+    struct addr_node *addr_root; // address-ordered index
+    block_header_t *zero_head;   // known-zero free blocks
+} heap_t;
+static heap_t g_heaps[J_MAX_SITE_GROUPS];
+
+static inline heap_t* heap_of(const block_header_t *blk) { return &g_heaps[blk->group]; }
+
+// call-site groups: a return address hashes to one of 256 buckets, and the
+// bucket table names its group
+static unsigned g_site_groups = 0; // 0 = off
+static unsigned char g_site_map[256];
+
+// leak tracking: blocks carry a 16-bit site id and g_leak_sites maps it back to
+// the first return address that hashed to it. the table is mapped on first use
+// and kept, so ids in live blocks stay resolvable after tracking is turned off.
+#define LEAK_SITES 65536u
+static int g_leak_on = 0;
+static _Atomic uintptr_t *g_leak_sites = NULL;
+static _Atomic unsigned long long g_leak_collisions = 0; // sites folded into another's id
+// per-thread heaps: a thread allocates from heap (id - 1) % g_thread_heaps
+static unsigned g_thread_heaps = 0; // 0 = off
+// any of these features picks a group or a site per allocation
+static int g_site_use = 0;
+// arenas moved between heaps instead of mapping new ones
+static unsigned long long g_steals = 0;      // under the heap lock
+static unsigned long long g_stolen_bytes = 0;
 static size_t g_total_bytes = 0;
 static size_t g_free_bytes  = 0;
 
+// one lock guards the block lists, the arenas and everything hanging off them.
+// functions named *_impl and the static helpers expect it to be held.
+static os_mutex_t g_heap_lock = OS_MUTEX_INIT;
+
+// block flags
+#define BLK_PURGED 0x1u // payload pages were handed back to the OS while free
+#define BLK_ZERO   0x2u // free block whose payload is known to be all zero
+#define BLK_CACHED 0x4u // parked in a thread cache: not free to the heap, not live either
+#define BLK_ZEROING 0x8u // checked out of the free index by prezero_pass, still free to everyone else
+
+// known-zero free blocks with room for two pointers are also linked through the
+// start of their payload. the words are cleared when a block leaves the list,
+// so the payload is all zero again by the time it is handed out
+typedef struct zero_link {
+    block_header_t *next, *prev;
+} zero_link_t;
+static size_t g_zero_free_bytes = 0; // free bytes in BLK_ZERO blocks
+
+// placement policy
+// every free block is handed to the active policy with insert_free and taken
+// back with remove_free before it is allocated, merged away or unmapped, so a
+// policy may keep its own index of free blocks per heap. reset drops that index
+// when the policy is (re)activated; it is then refilled from the block lists.
+typedef struct placement_policy {
+    const char *name;
+    block_header_t* (*find)(heap_t *h, size_t size);
+    void (*insert_free)(heap_t *h, block_header_t *blk);
+    void (*remove_free)(heap_t *h, block_header_t *blk);
+    void (*reset)(heap_t *h);
+} placement_policy_t;
+static const placement_policy_t k_policies[J_POLICY_COUNT];
+static const placement_policy_t *g_policy = &k_policies[J_POLICY_FIRST_FIT];
+static int g_policy_chosen = 0; // set once the policy is explicit or read from the environment
+
+// size classes
+// g_sc_round[size / 8 - 1] is the class a request of size bytes rounds up to,
+// for every size up to g_sc_limit (the largest class; 0 = no table)
+static size_t g_sc_table[J_SIZECLASS_MAX_COUNT];
+static size_t g_sc_count = 0;
+static size_t g_sc_limit = 0;
+static uint32_t g_sc_round[J_SIZECLASS_BINS];
+static int g_sc_env_read = 0;
+// online tuning: sizes of the next g_sc_window allocations go into g_sc_hist
+static unsigned long long g_sc_hist[J_SIZECLASS_BINS];
+static unsigned long long g_sc_window = 0;
+static size_t g_sc_tune_classes = 0;
+
+// memory budget
+// checked only when the heap grows (request_space), never per allocation
+static int g_budget_active = 0;
+static size_t g_budget_soft = 0;   // 0 = no soft limit
+static size_t g_budget_hard = 0;   // 0 = no hard limit
+static j_budget_cb g_budget_cb = NULL;
+static void *g_budget_ctx = NULL;
+static int g_budget_soft_crossed = 0; // latched until the heap drops below soft again
+static int g_budget_soft_pending = 0; // callback owed once the current operation finishes
+
+// memory pressure monitor
+// polled when the heap grows (rate limited) or explicitly via j_pressure_poll;
+// the level it derives drives how much free memory the heap keeps around
+#define PRESSURE_PATH_MAX 256
+static int g_pressure_enabled = 0;
+static int g_pressure_level = J_PRESSURE_NONE;
+static unsigned long long g_pressure_last_ms = 0;
+static char g_psi_path[PRESSURE_PATH_MAX];
+static char g_cg_current_path[PRESSURE_PATH_MAX];
+static char g_cg_high_path[PRESSURE_PATH_MAX];
+static j_pressure_config_t g_pressure_cfg;
+
+// per level: purge free blocks with at least this many whole pages (0 = no purge)
+// and keep at most this many fully free arenas mapped
+static const size_t k_purge_min_pages[4] = { 0, 64, 8, 1 };
+static const size_t k_retain_arenas[4]   = { (size_t)-1, 2, 1, 0 };
+// and shrink the thread cache budget by this shift
+static const unsigned k_tc_budget_shift[4] = { 0, 1, 2, 4 };
+
+// io_uring registered-buffer mode
+// while attached, every arena is registered as one fixed buffer of the ring
+// when it is mapped and unregistered before it is unmapped
+#define URING_MAX_BUFFER (1ul << 30) // kernel limit for one registered buffer
+static int g_uring_fd = -1;
+static unsigned g_uring_nslots = 0;
+static unsigned char *g_uring_used = NULL; // slot -> 1 while an arena occupies it
+
+// aligned I/O buffer pool
+// buffers are 4 KiB aligned and a multiple of 4 KiB long, carved back to back
+// from page spans; all metadata lives in an out-of-band span descriptor, so
+// there is no header (and no alignment slack) between buffers
+#define IOBUF_ALIGN 4096u
+// a span holds at least 16 buffers of one class and is at least 256 KiB, so
+// small classes batch their mmaps while a class's last, partly used span stays small
+#define IOBUF_SPAN_MIN_BUFS 16u
+#define IOBUF_SPAN_MIN_BYTES (256u << 10)
+#define IOBUF_NCLASS 24
+#define IOBUF_LARGE IOBUF_NCLASS // class id of a dedicated span holding one big buffer
+// every block multiple up to 64 KiB (typical I/O sizes waste nothing), then quarter steps
+static const size_t k_iobuf_class[IOBUF_NCLASS] = {
+    4u << 10,  8u << 10,  12u << 10, 16u << 10, 20u << 10, 24u << 10, 28u << 10, 32u << 10,
+    36u << 10, 40u << 10, 44u << 10, 48u << 10, 52u << 10, 56u << 10, 60u << 10, 64u << 10,
+    80u << 10, 96u << 10, 112u << 10, 128u << 10, 160u << 10, 192u << 10, 224u << 10, 256u << 10
+};
+
+typedef struct iobuf_span {
+    uint8_t *base;      // first buffer, page aligned
+    size_t size;        // bytes mapped at base
+    size_t buf_size;    // bytes per buffer
+    unsigned cls;       // index into k_iobuf_class, or IOBUF_LARGE
+    unsigned nbufs;     // buffers in this span
+    unsigned nfree;     // buffers currently free
+    uint64_t used;      // bit i set = buffer i handed out (at most 64 per span)
+    struct iobuf_span *next_partial; // per-class list of spans with free buffers
+    struct iobuf_span *prev_partial;
+} iobuf_span_t;
+
+static iobuf_span_t *g_iobuf_partial[IOBUF_NCLASS];
+static iobuf_span_t **g_iobuf_spans = NULL; // all spans sorted by base, for free()
+static size_t g_iobuf_nspans = 0;
+static size_t g_iobuf_cap = 0;
+static size_t g_iobuf_bytes = 0;
+static iobuf_span_t *g_iobuf_desc_free = NULL; // spare descriptors, linked by next_partial
+static os_mutex_t g_iobuf_lock = OS_MUTEX_INIT;   // the pool is independent of the heap lock
+
+// allocation hooks
+// a single global flag guards the whole hook machinery, so with no hooks
+// installed j_malloc/j_free/j_realloc pay one well-predicted branch
+static int g_hooks_active = 0;
+static j_hooks_t g_hooks;
+// set while a hook runs on this thread; allocations made from inside a hook
+// go straight to the allocator instead of recursing into the hooks
+static _Thread_local int t_in_hook = 0;
+static int g_hooks_set = 0; // j_set_hooks installed a table
+// allocation trace (j_trace_start). records are written under the heap lock so
+// they come out in the order the operations took effect; tracing rides on the
+// hook flag, so the fast paths do not look at it
+static FILE *g_trace_fp = NULL;
+
+// calloc / pre-zeroing counters (j_zero_stats)
+static _Atomic unsigned long long g_zs_calloc = 0;
+static _Atomic unsigned long long g_zs_known_zero = 0; // calloc bytes that needed no memset
+static _Atomic unsigned long long g_zs_memset = 0;     // calloc bytes zeroed on the request path
+static _Atomic unsigned long long g_zs_bg_zeroed = 0;
+static _Atomic unsigned long long g_zs_bg_purged = 0;
+
+#if defined(__GNUC__)
+    #define J_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+    #define J_UNLIKELY(x) (x)
+#endif
+
+// the caller of the function it is used in, for call-site groups
+#if defined(__GNUC__)
+    #define J_RETURN_ADDRESS() __builtin_return_address(0)
+#elif defined(_MSC_VER)
+    #include <intrin.h>
+    #define J_RETURN_ADDRESS() _ReturnAddress()
+#else
+    #define J_RETURN_ADDRESS() ((void*)0)
+#endif
+
+// per-thread state
+// each thread owns one record holding counters only it writes; readers walk
+// the registry and sum. records live in their own pages (not on the heap they
+// describe) and are folded into g_retired when the thread exits.
+typedef struct tag_counters {
+    _Atomic long long live_bytes; // signed: a block may be freed by another thread
+    _Atomic unsigned long long allocs;
+    _Atomic unsigned long long frees;
+} tag_counters_t;
+
+typedef struct thread_counters {
+    _Atomic unsigned long long allocs;
+    _Atomic unsigned long long frees;
+    _Atomic unsigned long long bytes_allocated;
+    _Atomic unsigned long long bytes_freed;
+    _Atomic unsigned long long remote_frees; // blocks another thread allocated
+    _Atomic unsigned long long heap_grows;   // allocations no free block could serve
+} thread_counters_t;
+
+// thread cache (j_thread_cache)
+// freed blocks of up to J_TCACHE_MAX_SIZE bytes are parked per thread in one
+// list per 8-byte class, linked through their first payload word, and handed
+// back out without the heap lock. each list's capacity moves with what it sees:
+// a miss (empty list) grows it, overflowing frees grow it while it is small and
+// shrink it once it keeps overflowing at a large size. the capacity of all
+// lists together is held under g_tc_budget bytes by taking capacity away from
+// the thread that has done the least caching since it was last looked at.
+// a miss after the list had to spill means it was too short: it grows (by one
+// block while small, then a batch at a time). frees that find it full grow it
+// while small and otherwise spill. blocks that sat unused through a whole
+// review period go back to the heap, and the list's capacity with them.
+#define TC_CLASSES J_TCACHE_CLASSES
+#define TC_MAX_SIZE J_TCACHE_MAX_SIZE
+#define TC_BATCH 32      // growth step once a list is warm, most blocks spilled per overflow
+#define TC_CAP_MAX 1024  // blocks per list
+#define TC_REVIEW 4096   // parks between two reviews of a thread's lists
+
+typedef struct tc_bin {
+    void *head;
+    _Atomic unsigned count;  // written by the owner only
+    _Atomic unsigned cap;    // the owner grows it, owner and stealers shrink it
+    unsigned low;            // fewest blocks held since the last review
+    unsigned spilled;        // blocks overflow sent to the heap since the last miss
+    _Atomic unsigned long long hits;
+    _Atomic unsigned long long misses;
+    _Atomic unsigned long long overflows;
+} tc_bin_t;
+
+static int g_tc_active = 0;  // cache on and the heaps not split
+// turning the cache off bumps the generation; every thread whose record still
+// names an older one empties its lists on its next malloc or free. g_tc_stale
+// counts those threads, so the fast paths only look at their own record while
+// there are any
+static _Atomic unsigned g_tc_gen = 0;
+static _Atomic unsigned g_tc_stale = 0;
+// the cache rewrites block headers (flags, tag, site) without the heap lock.
+// a heap walk raises g_tc_walk and waits until no thread is inside such a
+// rewrite; while it is up the fast paths go to the heap instead, so the walk
+// reads every header whole
+static _Atomic int g_tc_walk = 0;
+static size_t g_tc_budget = 0;
+static size_t g_tc_limit = 0; // g_tc_budget scaled down by the pressure level
+static _Atomic size_t g_tc_cap_total = 0; // capacity granted to all lists, in bytes
+static _Atomic unsigned long long g_tc_steals = 0;
+
+// deferred frees are parked in page-sized chunks outside the blocks themselves,
+// because readers may still be looking at the blocks' contents
+#define DEFER_CHUNK_PTRS 509
+typedef struct defer_chunk {
+    struct defer_chunk *next;
+    unsigned long long epoch; // epoch the pointers were retired in (orphans only)
+    size_t count;
+    void *ptrs[DEFER_CHUNK_PTRS];
+} defer_chunk_t;
+
+// pointers retired by one thread during one epoch
+typedef struct defer_bag {
+    unsigned long long epoch;
+    defer_chunk_t *chunks; // head chunk is the one being filled
+} defer_bag_t;
+
+typedef struct thread_state {
+    struct thread_state *next;
+    struct thread_state *prev;
+    tag_counters_t tags[J_MAX_TAGS];
+    // epoch reclamation: (epoch << 1) | 1 while inside a critical section, 0 outside
+    _Atomic unsigned long long epoch_state;
+    unsigned epoch_nest;
+    unsigned defer_since_collect;
+    defer_bag_t bags[3]; // indexed by epoch % 3
+    defer_chunk_t *spare_chunk;
+    // async free queue: blocks linked through their first payload word.
+    // only the owner pushes; the reclaimer takes the whole list at once.
+    _Atomic(void*) async_head;
+    unsigned async_since_wake;
+    // allocation volume (j_thread_stats)
+    thread_counters_t counters;
+    unsigned long long id;   // registration order, from 1
+    unsigned char owner;     // stamped into the blocks this thread allocates, never 0
+    char name[J_THREAD_NAME_MAX]; // under g_threads_lock
+    // thread cache; only the owner touches the lists
+    tc_bin_t tc[TC_CLASSES];
+    _Atomic size_t tc_bytes;              // payload bytes parked
+    _Atomic size_t tc_cap_bytes;          // capacity of all lists, in bytes
+    _Atomic unsigned long long tc_ops;    // cache hits and parks, for idleness
+    unsigned long long tc_ops_seen;       // tc_ops at the last steal scan, under g_threads_lock
+    unsigned tc_since_review;
+    _Atomic unsigned tc_gen;              // g_tc_gen this cache was last emptied for
+    _Atomic int tc_busy;                  // rewriting a block header without the heap lock
+} thread_state_t;
+
+static os_mutex_t g_threads_lock = OS_MUTEX_INIT;
+static thread_state_t *g_threads = NULL; // registry of live thread records
+static thread_state_t g_retired;         // totals of threads that have exited
+static _Thread_local thread_state_t *t_state = NULL;
+static unsigned long long g_thread_seq = 0; // under g_threads_lock
+// owner bytes of live threads, under g_threads_lock. exited threads give theirs
+// back, so live threads only share one once more than 255 run at the same time
+static unsigned char g_owner_used[256];
+static unsigned g_owner_rover = 0;
+
+// global epoch; a block retired in epoch e is freed once the epoch reaches e + 2
+static _Atomic unsigned long long g_epoch = 1;
+static defer_chunk_t *g_orphan_chunks = NULL; // retired by exited threads, under g_threads_lock
+static void *g_async_orphans = NULL;          // async queues of exited threads, under g_threads_lock
+
+// single-writer counter update: only the owning thread writes, so a relaxed
+// load + store is enough and compiles to plain moves
+static inline void counter_add_ll(_Atomic long long *c, long long n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+static inline void counter_inc(_Atomic unsigned long long *c) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+static inline void counter_add(_Atomic unsigned long long *c, unsigned long long n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// the next free owner byte after the last one handed out; under g_threads_lock
+static unsigned char owner_claim(unsigned long long id) {
+    for (unsigned i = 0; i < 255; ++i) {
+        unsigned o = (g_owner_rover + i) % 255 + 1;
+        if (!g_owner_used[o]) {
+            g_owner_used[o] = 1;
+            g_owner_rover = o;
+            return (unsigned char)o;
+        }
+    }
+    return (unsigned char)(id % 255 + 1); // all taken: share one
+}
+
+static thread_state_t* thread_state_create(void) {
+    thread_state_t *ts = (thread_state_t*)os_alloc(sizeof(thread_state_t));
+    if (!ts) return NULL;
+    // fresh anonymous pages are zeroed, so all counters start at 0
+    os_thread_name(ts->name, sizeof(ts->name));
+    os_mutex_lock(&g_threads_lock);
+    ts->id = ++g_thread_seq;
+    ts->owner = owner_claim(ts->id);
+    ts->tc_gen = atomic_load_explicit(&g_tc_gen, memory_order_relaxed);
+    ts->prev = NULL;
+    ts->next = g_threads;
+    if (g_threads) g_threads->prev = ts;
+    g_threads = ts;
+    os_mutex_unlock(&g_threads_lock);
+    t_state = ts;
+    os_on_thread_exit(ts);
+    return ts;
+}
+
+static inline thread_state_t* thread_state(void) {
+    thread_state_t *ts = t_state;
+    return ts ? ts : thread_state_create();
+}
+
+static void tc_flush(thread_state_t *ts, int drop_capacity);
+
+// fold an exiting thread's counters into g_retired and drop its record
+static void thread_state_release(void *arg) {
+    thread_state_t *ts = (thread_state_t*)arg;
+    // cached blocks go back to the heap first (heap lock before g_threads_lock)
+    tc_flush(ts, 1);
+    os_mutex_lock(&g_threads_lock);
+    if (ts->tc_gen != g_tc_gen) g_tc_stale--;
+    for (int t = 0; t < J_MAX_TAGS; ++t) {
+        g_retired.tags[t].live_bytes += ts->tags[t].live_bytes;
+        g_retired.tags[t].allocs += ts->tags[t].allocs;
+        g_retired.tags[t].frees += ts->tags[t].frees;
+    }
+    thread_counters_t *rc = &g_retired.counters, *c = &ts->counters;
+    rc->allocs += c->allocs;
+    rc->frees += c->frees;
+    rc->bytes_allocated += c->bytes_allocated;
+    rc->bytes_freed += c->bytes_freed;
+    rc->remote_frees += c->remote_frees;
+    rc->heap_grows += c->heap_grows;
+    for (int k = 0; k < TC_CLASSES; ++k) {
+        g_retired.tc[k].hits += ts->tc[k].hits;
+        g_retired.tc[k].misses += ts->tc[k].misses;
+        g_retired.tc[k].overflows += ts->tc[k].overflows;
+    }
+    // blocks this thread retired still wait for their grace period
+    for (int b = 0; b < 3; ++b) {
+        defer_chunk_t *dc = ts->bags[b].chunks;
+        while (dc) {
+            defer_chunk_t *next = dc->next;
+            if (dc->count) {
+                dc->epoch = ts->bags[b].epoch;
+                dc->next = g_orphan_chunks;
+                g_orphan_chunks = dc;
+            } else {
+                os_free(dc, sizeof(defer_chunk_t));
+            }
+            dc = next;
+        }
+    }
+    // hand queued async frees to the reclaimer
+    void *q = atomic_exchange_explicit(&ts->async_head, NULL, memory_order_acquire);
+    while (q) {
+        void *next = *(void**)q;
+        *(void**)q = g_async_orphans;
+        g_async_orphans = q;
+        q = next;
+    }
+    if (ts->prev) ts->prev->next = ts->next;
+    else g_threads = ts->next;
+    if (ts->next) ts->next->prev = ts->prev;
+    // a byte shared past 255 live threads stays taken until its claimant goes
+    int shared = 0;
+    for (thread_state_t *o = g_threads; o && !shared; o = o->next) shared = o->owner == ts->owner;
+    if (!shared) g_owner_used[ts->owner] = 0;
+    os_mutex_unlock(&g_threads_lock);
+    if (ts->spare_chunk) os_free(ts->spare_chunk, sizeof(defer_chunk_t));
+    if (t_state == ts) t_state = NULL;
+    os_free(ts, sizeof(thread_state_t));
+}
+
+// live blocks carry the allocating thread's owner byte in the high half of
+// flags (the page state bits only mean something while a block is free)
+#define BLK_OWNER_SHIFT 8
+#define BLK_STATE_MASK  0xffu
+
+// accounting for one block entering or leaving the live set
+static inline void account_alloc(block_header_t *blk) {
+    thread_state_t *ts = thread_state();
+    if (!ts) return;
+    counter_add_ll(&ts->tags[blk->tag].live_bytes, (long long)blk->size);
+    counter_inc(&ts->tags[blk->tag].allocs);
+    counter_inc(&ts->counters.allocs);
+    counter_add(&ts->counters.bytes_allocated, blk->size);
+    blk->flags = (unsigned short)(ts->owner << BLK_OWNER_SHIFT);
+}
+static inline void account_free(const block_header_t *blk) {
+    thread_state_t *ts = thread_state();
+    if (!ts) return;
+    counter_add_ll(&ts->tags[blk->tag].live_bytes, -(long long)blk->size);
+    counter_inc(&ts->tags[blk->tag].frees);
+    counter_inc(&ts->counters.frees);
+    counter_add(&ts->counters.bytes_freed, blk->size);
+    if ((blk->flags >> BLK_OWNER_SHIFT) != ts->owner) counter_inc(&ts->counters.remote_frees);
+}
+static inline void account_resize(const block_header_t *blk, size_t old_size) {
+    thread_state_t *ts = thread_state();
+    if (!ts) return;
+    counter_add_ll(&ts->tags[blk->tag].live_bytes, (long long)blk->size - (long long)old_size);
+    if (blk->size > old_size) counter_add(&ts->counters.bytes_allocated, blk->size - old_size);
+    else counter_add(&ts->counters.bytes_freed, old_size - blk->size);
+}
+static inline void account_grow(void) {
+    thread_state_t *ts = thread_state();
+    if (ts) counter_inc(&ts->counters.heap_grows);
+}
+
+// flight recorder
+// an always-on ring of the last FR_EVENTS rare events (arena maps and unmaps,
+// purges, large and failed allocations, budget crossings, periodic heap
+// snapshots), so a crash dump can show what the allocator did just before.
+// writers claim a slot with one fetch_add and publish it through seq; nothing
+// on the malloc/free fast paths records anything
+#define FR_EVENTS J_FLIGHT_EVENTS
+#define FR_LARGE_ALLOC (1u << 20) // allocations at least this big are recorded
+enum {
+    FR_ARENA_MAP = 1, FR_ARENA_UNMAP, FR_PURGE, FR_LARGE, FR_ALLOC_FAIL, FR_SOFT_LIMIT, FR_SNAPSHOT, FR_KINDS
+};
+static const char *const k_fr_names[FR_KINDS] = {
+    "?", "arena_map", "arena_unmap", "purge", "large_alloc", "alloc_fail", "soft_limit", "snapshot"
+};
+// the two fields of each kind, as printed in the dump
+static const char *const k_fr_fields[FR_KINDS][2] = {
+    { "a", "b" }, { "addr", "size" }, { "addr", "size" }, { "bytes", "ranges" },
+    { "ptr", "size" }, { "size", "errno" }, { "heap", "soft" }, { "heap", "free" }
+};
+
+typedef struct fr_event {
+    _Atomic unsigned long long seq; // slot index + 1 once written, 0 while being written
+    unsigned long long ms;          // os_now_ms
+    unsigned long long a, b;
+    unsigned long long thread;      // j_thread_stats id, 0 if the thread has no record
+    unsigned kind;
+} fr_event_t;
+
+static fr_event_t g_fr_ring[FR_EVENTS];
+static _Atomic unsigned long long g_fr_next = 0;
+
+static void fr_record(unsigned kind, unsigned long long a, unsigned long long b) {
+    unsigned long long i = atomic_fetch_add_explicit(&g_fr_next, 1, memory_order_relaxed);
+    fr_event_t *e = &g_fr_ring[i % FR_EVENTS];
+    atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e->ms = os_now_ms();
+    e->kind = kind;
+    e->a = a;
+    e->b = b;
+    e->thread = t_state ? t_state->id : 0;
+    atomic_store_explicit(&e->seq, i + 1, memory_order_release);
+}
+
 // return header sizes aligned to ALIGNMENT
 static inline size_t header_size(void) { 
     return ALIGN_UP(sizeof(block_header_t), ALIGNMENT); 
@@ -83,25 +905,572 @@ static inline size_t arena_header_size(void) {
 
 // helpers
 static void split_block(block_header_t *blk, size_t want);
+static void free_index_insert(heap_t *h, block_header_t *blk);
+static void free_index_remove(heap_t *h, block_header_t *blk);
+static block_header_t* zero_find(heap_t *h, size_t size);
 static block_header_t* coalesce(block_header_t *blk);
-static block_header_t* find_first_fit(size_t size);
-static block_header_t* request_space(size_t size);
+static void release_block(block_header_t *blk);
+static block_header_t* request_space(heap_t *h, size_t size);
+static block_header_t* steal_arena(heap_t *h, size_t size);
+static void policy_activate(const placement_policy_t *p);
+static void policy_init_from_env(void);
+static void sizeclass_init_from_env(void);
+static void sizeclass_record(size_t size);
+static int blocks_adjacent(const block_header_t *a, const block_header_t *b);
+static void budget_on_soft_limit(void);
+static size_t purge_free_blocks(size_t min_pages);
+static size_t trim_arenas(size_t retain);
+static void uring_register_arena(arena_header_t *a);
+static void uring_unregister_arena(arena_header_t *a);
+
+static size_t pressure_poll_impl(void);
+
+static void *malloc_impl(size_t size, unsigned tag, unsigned group, unsigned site);
+static void *alloc_impl(size_t size, unsigned tag, unsigned group, unsigned site, int want_zero, int *zeroed);
+static void  free_impl(void *ptr);
+static void *realloc_impl(void *ptr, size_t new_size, unsigned group, unsigned site);
+static void *heap_malloc(size_t size, unsigned tag, unsigned group, unsigned site);
+static void *heap_calloc(size_t size, unsigned group, unsigned site);
+static void  heap_free(void *ptr);
+static void *heap_realloc(void *ptr, size_t new_size, unsigned group, unsigned site);
+static void *malloc_hooked(size_t size, unsigned tag, unsigned group, unsigned site);
+static void  free_hooked(void *ptr);
+static void *realloc_hooked(void *ptr, size_t new_size, unsigned group, unsigned site);
 
 // api
-// main malloc function
+// the code that called into the api picks the block's group (call-site
+// groups) and its site id (leak tracking); both are off unless g_site_use
+static inline unsigned site_group(const void *ret) {
+    uint64_t h = (uint64_t)(uintptr_t)ret * 0x9E3779B97F4A7C15ull;
+    return g_site_map[h >> 56];
+}
+
+// slow path of site_id: the slot is empty or names another address
+static void site_claim(unsigned id, const void *ret, uintptr_t seen) {
+    if (seen == 0 && atomic_compare_exchange_strong_explicit(&g_leak_sites[id], &seen, (uintptr_t)ret,
+                                                             memory_order_relaxed, memory_order_relaxed)) return;
+    if (seen != (uintptr_t)ret) atomic_fetch_add_explicit(&g_leak_collisions, 1, memory_order_relaxed);
+}
+
+// a 16-bit id whose table slot remembers the first address that hashed to it
+static inline unsigned site_id(const void *ret) {
+    if (!g_leak_on) return 0;
+    unsigned id = (unsigned)(((uint64_t)(uintptr_t)ret * 0x9E3779B97F4A7C15ull) >> 48);
+    if (id == 0) id = 1; // 0 means untracked
+    uintptr_t seen = atomic_load_explicit(&g_leak_sites[id], memory_order_relaxed);
+    if (J_UNLIKELY(seen != (uintptr_t)ret)) site_claim(id, ret, seen);
+    return id;
+}
+
+// heap of the calling thread when per-thread heaps are on
+static inline unsigned thread_heap(void) {
+    thread_state_t *ts = thread_state();
+    return ts ? (unsigned)((ts->id - 1) % g_thread_heaps) : 0;
+}
+
+static inline void pick_origin(const void *ret, unsigned *group, unsigned *site) {
+    *group = g_thread_heaps ? thread_heap() : site_group(ret);
+    *site = site_id(ret);
+}
+
+// thread cache
+static inline size_t tc_class_bytes(unsigned c) {
+    return (size_t)(c + 1) * ALIGNMENT;
+}
+
+// lower a list's capacity by up to n blocks and return them to the budget;
+// returns how many were taken. the owner may be growing the list meanwhile
+static unsigned tc_cap_take(thread_state_t *ts, tc_bin_t *b, unsigned c, unsigned n) {
+    unsigned cur = atomic_load_explicit(&b->cap, memory_order_relaxed), take;
+    do {
+        take = cur < n ? cur : n;
+        if (!take) return 0;
+    } while (!atomic_compare_exchange_weak_explicit(&b->cap, &cur, cur - take,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    size_t bytes = (size_t)take * tc_class_bytes(c);
+    atomic_fetch_sub_explicit(&ts->tc_cap_bytes, bytes, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&g_tc_cap_total, bytes, memory_order_relaxed);
+    return take;
+}
+
+// take about want bytes of capacity from the thread that cached least since
+// the previous scan (the caller's other lists if no other thread has any;
+// self may be NULL),
+// largest lists first. the victim's lists shrink at once; the blocks it holds
+// above the new capacity go back to the heap on its next park in that class,
+// its next review or when it exits
+static size_t tc_steal(thread_state_t *self, unsigned skip, size_t want) {
+    size_t got = 0;
+    os_mutex_lock(&g_threads_lock);
+    thread_state_t *victim = NULL;
+    unsigned long long victim_ops = 0;
+    for (thread_state_t *ts = g_threads; ts; ts = ts->next) {
+        unsigned long long ops = atomic_load_explicit(&ts->tc_ops, memory_order_relaxed);
+        unsigned long long busy = ops - ts->tc_ops_seen;
+        ts->tc_ops_seen = ops;
+        if (ts == self || atomic_load_explicit(&ts->tc_cap_bytes, memory_order_relaxed) == 0) continue;
+        if (!victim || busy < victim_ops) {
+            victim = ts;
+            victim_ops = busy;
+        }
+    }
+    if (!victim) victim = self;
+    while (victim && got < want) {
+        unsigned best = TC_CLASSES;
+        size_t best_bytes = 0;
+        for (unsigned c = 0; c < TC_CLASSES; ++c) {
+            if (victim == self && c == skip) continue;
+            size_t bytes = atomic_load_explicit(&victim->tc[c].cap, memory_order_relaxed) * tc_class_bytes(c);
+            if (bytes > best_bytes) {
+                best = c;
+                best_bytes = bytes;
+            }
+        }
+        if (best == TC_CLASSES) break;
+        size_t per = tc_class_bytes(best);
+        got += tc_cap_take(victim, &victim->tc[best], best, (unsigned)((want - got + per - 1) / per)) * per;
+    }
+    if (got) atomic_fetch_add_explicit(&g_tc_steals, 1, memory_order_relaxed);
+    os_mutex_unlock(&g_threads_lock);
+    return got;
+}
+
+// recompute the budget in force after a change of budget or pressure level and
+// take back what all lists hold above it, idlest threads first; heap lock held
+static void tc_set_limit(void) {
+    g_tc_limit = g_tc_budget >> k_tc_budget_shift[g_pressure_level];
+    for (;;) {
+        size_t total = atomic_load_explicit(&g_tc_cap_total, memory_order_relaxed);
+        if (total <= g_tc_limit || !tc_steal(NULL, TC_CLASSES, total - g_tc_limit)) break;
+    }
+}
+
+// raise list c's capacity by up to n blocks, as far as the budget allows
+static void tc_grow(thread_state_t *ts, tc_bin_t *b, unsigned c, unsigned n) {
+    unsigned cap = atomic_load_explicit(&b->cap, memory_order_relaxed);
+    if (cap >= TC_CAP_MAX) return;
+    if (n > TC_CAP_MAX - cap) n = TC_CAP_MAX - cap;
+    size_t bytes = (size_t)n * tc_class_bytes(c);
+    size_t total = atomic_fetch_add_explicit(&g_tc_cap_total, bytes, memory_order_relaxed) + bytes;
+    size_t limit = g_tc_limit;
+    if (total > limit) {
+        atomic_fetch_sub_explicit(&g_tc_cap_total, bytes, memory_order_relaxed);
+        if (tc_steal(ts, c, total - limit) < total - limit) return;
+        total = atomic_fetch_add_explicit(&g_tc_cap_total, bytes, memory_order_relaxed) + bytes;
+        if (total > limit) {
+            atomic_fetch_sub_explicit(&g_tc_cap_total, bytes, memory_order_relaxed);
+            return;
+        }
+    }
+    // bytes before blocks, so a stealer never takes more than the record holds
+    atomic_fetch_add_explicit(&ts->tc_cap_bytes, bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&b->cap, n, memory_order_relaxed);
+}
+
+// open a header rewrite; 0 while a heap walk runs (the caller then takes the
+// heap path). the seq_cst store and load pair with the ones in tc_walk_begin
+static inline int tc_enter(thread_state_t *ts) {
+    atomic_store(&ts->tc_busy, 1);
+    if (J_UNLIKELY(atomic_load(&g_tc_walk))) {
+        atomic_store_explicit(&ts->tc_busy, 0, memory_order_release);
+        return 0;
+    }
+    return 1;
+}
+static inline void tc_leave(thread_state_t *ts) {
+    atomic_store_explicit(&ts->tc_busy, 0, memory_order_release);
+}
+
+// keep the cache off the block headers for the length of a heap walk; heap
+// lock held. a rewrite never takes a lock, so the wait is short
+static void tc_walk_begin(void) {
+    atomic_store(&g_tc_walk, 1);
+    os_mutex_lock(&g_threads_lock);
+    for (thread_state_t *ts = g_threads; ts; ts = ts->next) {
+        while (atomic_load_explicit(&ts->tc_busy, memory_order_acquire)) os_yield();
+    }
+    os_mutex_unlock(&g_threads_lock);
+}
+static void tc_walk_end(void) {
+    atomic_store_explicit(&g_tc_walk, 0, memory_order_release);
+}
+
+// inside tc_enter/tc_leave
+static inline void tc_push(thread_state_t *ts, tc_bin_t *b, block_header_t *blk) {
+    void *p = (uint8_t*)blk + header_size();
+    blk->flags = BLK_CACHED;
+    *(void**)p = b->head;
+    b->head = p;
+    atomic_store_explicit(&b->count, atomic_load_explicit(&b->count, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&ts->tc_bytes, atomic_load_explicit(&ts->tc_bytes, memory_order_relaxed) + blk->size,
+                          memory_order_relaxed);
+}
+
+// hand n blocks from the head of a list back to the heap; heap lock held
+static void tc_spill(thread_state_t *ts, tc_bin_t *b, unsigned n) {
+    unsigned count = atomic_load_explicit(&b->count, memory_order_relaxed);
+    size_t bytes = 0;
+    for (unsigned i = 0; i < n && b->head; ++i, --count) {
+        block_header_t *blk = (block_header_t*)((uint8_t*)b->head - header_size());
+        b->head = *(void**)b->head;
+        bytes += blk->size;
+        release_block(blk);
+    }
+    atomic_store_explicit(&b->count, count, memory_order_relaxed);
+    atomic_store_explicit(&ts->tc_bytes, atomic_load_explicit(&ts->tc_bytes, memory_order_relaxed) - bytes,
+                          memory_order_relaxed);
+    if (b->low > count) b->low = count;
+}
+
+// empty every list into the heap, and with drop_capacity give up their capacity
+static void tc_flush(thread_state_t *ts, int drop_capacity) {
+    if (atomic_load_explicit(&ts->tc_bytes, memory_order_relaxed) == 0) goto capacity;
+    os_mutex_lock(&g_heap_lock);
+    for (unsigned c = 0; c < TC_CLASSES; ++c) {
+        tc_bin_t *b = &ts->tc[c];
+        if (b->head) tc_spill(ts, b, atomic_load_explicit(&b->count, memory_order_relaxed));
+        b->low = 0;
+        b->spilled = 0;
+    }
+    os_mutex_unlock(&g_heap_lock);
+capacity:
+    if (!drop_capacity) return;
+    for (unsigned c = 0; c < TC_CLASSES; ++c) tc_cap_take(ts, &ts->tc[c], c, TC_CAP_MAX);
+}
+
+// the cache went off: take every thread's capacity back now and mark their
+// lists stale; each thread empties its own on its next malloc or free (or at
+// exit), since only the owner may touch them. heap lock held
+static void tc_retire_all(void) {
+    os_mutex_lock(&g_threads_lock);
+    unsigned old = atomic_fetch_add_explicit(&g_tc_gen, 1, memory_order_relaxed);
+    for (thread_state_t *ts = g_threads; ts; ts = ts->next) {
+        if (atomic_load_explicit(&ts->tc_gen, memory_order_relaxed) == old) g_tc_stale++;
+        for (unsigned c = 0; c < TC_CLASSES; ++c) tc_cap_take(ts, &ts->tc[c], c, TC_CAP_MAX);
+    }
+    os_mutex_unlock(&g_threads_lock);
+}
+
+// recompute whether the cache is in use; heap lock held
+static void tc_update_active(void) {
+    int was = g_tc_active;
+    g_tc_active = g_tc_budget && !g_site_groups && !g_thread_heaps;
+    if (was && !g_tc_active) tc_retire_all();
+}
+
+// slow path of the fast paths while some thread's cache is stale
+static void tc_sync(void) {
+    thread_state_t *ts = t_state;
+    if (!ts) return;
+    unsigned gen = atomic_load_explicit(&g_tc_gen, memory_order_relaxed);
+    if (atomic_load_explicit(&ts->tc_gen, memory_order_relaxed) == gen) return;
+    tc_flush(ts, 1);
+    os_mutex_lock(&g_threads_lock);
+    atomic_store_explicit(&ts->tc_gen, gen, memory_order_relaxed);
+    g_tc_stale--;
+    os_mutex_unlock(&g_threads_lock);
+}
+
+// lists that never went below `low` blocks during the last period held those
+// blocks for nothing: half of them go back to the heap, and a warm list's
+// capacity drops by a batch. lists a stealer shrank drop what they hold over
+static void tc_review(thread_state_t *ts) {
+    int locked = 0;
+    for (unsigned c = 0; c < TC_CLASSES; ++c) {
+        tc_bin_t *b = &ts->tc[c];
+        unsigned count = atomic_load_explicit(&b->count, memory_order_relaxed);
+        unsigned cap = atomic_load_explicit(&b->cap, memory_order_relaxed);
+        unsigned drop = count > cap ? count - cap : 0;
+        if (b->low) {
+            unsigned idle = b->low > 1 ? b->low / 2 : 1;
+            if (idle > drop) drop = idle;
+            if (cap > TC_BATCH) tc_cap_take(ts, b, c, cap - TC_BATCH < TC_BATCH ? cap - TC_BATCH : TC_BATCH);
+        }
+        if (drop) {
+            if (!locked) os_mutex_lock(&g_heap_lock);
+            locked = 1;
+            tc_spill(ts, b, drop);
+        }
+        b->low = atomic_load_explicit(&b->count, memory_order_relaxed);
+    }
+    if (locked) os_mutex_unlock(&g_heap_lock);
+}
+
+// a request for a class whose list is empty
+static void tc_miss(thread_state_t *ts, tc_bin_t *b, unsigned c) {
+    counter_inc(&b->misses);
+    if (!b->spilled) return; // the list ran dry without ever being full
+    b->spilled = 0;
+    tc_grow(ts, b, c, atomic_load_explicit(&b->cap, memory_order_relaxed) < TC_BATCH ? 1 : TC_BATCH);
+}
+
+// a free that found its list full
+static void tc_overflow(thread_state_t *ts, tc_bin_t *b, unsigned c, block_header_t *blk) {
+    counter_inc(&b->overflows);
+    unsigned cap = atomic_load_explicit(&b->cap, memory_order_relaxed);
+    unsigned count = atomic_load_explicit(&b->count, memory_order_relaxed);
+    if (cap < TC_BATCH && count == cap) {
+        // slow start
+        tc_grow(ts, b, c, 1);
+        cap = atomic_load_explicit(&b->cap, memory_order_relaxed);
+        if (count < cap && tc_enter(ts)) {
+            tc_push(ts, b, blk);
+            tc_leave(ts);
+            return;
+        }
+    }
+    // spill this block and enough of the list to make room for more frees
+    unsigned room = cap / 2 < TC_BATCH ? cap / 2 : TC_BATCH;
+    unsigned n = count > cap - room ? count - (cap - room) : 0;
+    os_mutex_lock(&g_heap_lock);
+    release_block(blk);
+    if (n) tc_spill(ts, b, n);
+    os_mutex_unlock(&g_heap_lock);
+    b->spilled += n + 1;
+}
+
+// a block from the calling thread's cache, or NULL (the caller then goes to the heap)
+static inline void *tc_alloc(size_t size, unsigned tag, unsigned site) {
+    size = ALIGN_UP(size, ALIGNMENT);
+    if (size <= g_sc_limit) size = g_sc_round[size / ALIGNMENT - 1];
+    if (size > TC_MAX_SIZE) return NULL;
+    thread_state_t *ts = thread_state();
+    if (!ts) return NULL;
+    unsigned c = (unsigned)(size / ALIGNMENT - 1);
+    tc_bin_t *b = &ts->tc[c];
+    void *p = b->head;
+    if (J_UNLIKELY(!p)) {
+        tc_miss(ts, b, c);
+        return NULL;
+    }
+    if (J_UNLIKELY(!tc_enter(ts))) return NULL;
+    b->head = *(void**)p;
+    unsigned count = atomic_load_explicit(&b->count, memory_order_relaxed) - 1;
+    atomic_store_explicit(&b->count, count, memory_order_relaxed);
+    if (count < b->low) b->low = count;
+    counter_inc(&b->hits);
+    counter_inc(&ts->tc_ops);
+    block_header_t *blk = (block_header_t*)((uint8_t*)p - header_size());
+    atomic_store_explicit(&ts->tc_bytes, atomic_load_explicit(&ts->tc_bytes, memory_order_relaxed) - blk->size,
+                          memory_order_relaxed);
+    blk->tag = (unsigned short)tag;
+    blk->site = (unsigned short)site;
+    account_alloc(blk);
+    tc_leave(ts);
+    return p;
+}
+
+// park a freed block in the calling thread's cache; 0 if it is too big for one
+static inline int tc_free(void *ptr) {
+    block_header_t *blk = (block_header_t*)((uint8_t*)ptr - header_size());
+    if (blk->size > TC_MAX_SIZE) return 0;
+    // freeing a free or parked block is ignored, as on the heap
+    if (blk->free || (blk->flags & (BLK_CACHED | BLK_ZEROING))) return 1;
+    thread_state_t *ts = thread_state();
+    if (!ts) return 0;
+    unsigned c = (unsigned)(blk->size / ALIGNMENT - 1);
+    tc_bin_t *b = &ts->tc[c];
+    if (J_UNLIKELY(!tc_enter(ts))) return 0;
+    account_free(blk);
+    counter_inc(&ts->tc_ops);
+    if (J_UNLIKELY(atomic_load_explicit(&b->count, memory_order_relaxed) >= atomic_load_explicit(&b->cap, memory_order_relaxed))) {
+        tc_leave(ts);
+        tc_overflow(ts, b, c, blk);
+    } else {
+        tc_push(ts, b, blk);
+        tc_leave(ts);
+    }
+    if (J_UNLIKELY(++ts->tc_since_review >= TC_REVIEW)) {
+        ts->tc_since_review = 0;
+        tc_review(ts);
+    }
+    return 1;
+}
+
+static inline void *malloc_from(size_t size, unsigned tag, const void *ret) {
+    unsigned group = 0, site = 0;
+    if (J_UNLIKELY(g_site_use)) pick_origin(ret, &group, &site);
+    if (J_UNLIKELY(g_tc_stale)) tc_sync();
+    if (J_UNLIKELY(g_hooks_active)) return malloc_hooked(size, tag, group, site);
+    if (J_UNLIKELY(g_tc_active) && size - 1 < TC_MAX_SIZE && !g_sc_window) {
+        void *p = tc_alloc(size, tag, site);
+        if (p) return p;
+    }
+    return heap_malloc(size, tag, group, site);
+}
+
 void *j_malloc(size_t size) {
+    return malloc_from(size, 0, J_RETURN_ADDRESS());
+}
+
+void *j_malloc_tagged(unsigned tag, size_t size) {
+    if (tag >= J_MAX_TAGS) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return malloc_from(size, tag, J_RETURN_ADDRESS());
+}
+
+void *j_calloc(size_t n, size_t size) {
+    if (size && n > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    unsigned group = 0, site = 0;
+    if (J_UNLIKELY(g_site_use)) pick_origin(J_RETURN_ADDRESS(), &group, &site);
+    if (J_UNLIKELY(g_hooks_active)) {
+        // hooks and traces see a plain allocation
+        void *p = malloc_hooked(n * size, 0, group, site);
+        if (p) {
+            memset(p, 0, n * size);
+            atomic_fetch_add_explicit(&g_zs_calloc, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&g_zs_memset, n * size, memory_order_relaxed);
+        }
+        return p;
+    }
+    return heap_calloc(n * size, group, site);
+}
+
+void j_free(void *ptr) {
+    if (J_UNLIKELY(g_tc_stale)) tc_sync();
+    if (J_UNLIKELY(g_hooks_active)) { free_hooked(ptr); return; }
+    if (J_UNLIKELY(g_tc_active) && ptr && tc_free(ptr)) return;
+    heap_free(ptr);
+}
+
+void *j_realloc(void *ptr, size_t new_size) {
+    // only realloc(NULL, n) places a new block; a moved block keeps its origin
+    unsigned group = 0, site = 0;
+    if (J_UNLIKELY(g_site_use) && !ptr) pick_origin(J_RETURN_ADDRESS(), &group, &site);
+    if (J_UNLIKELY(g_hooks_active)) return realloc_hooked(ptr, new_size, group, site);
+    return heap_realloc(ptr, new_size, group, site);
+}
+
+// bulk free: one trip through the heap lock for the whole batch
+void j_free_batch(void **ptrs, size_t n) {
+    if (J_UNLIKELY(g_hooks_active)) {
+        for (size_t i = 0; i < n; ++i) free_hooked(ptrs[i]);
+        return;
+    }
+    os_mutex_lock(&g_heap_lock);
+    for (size_t i = 0; i < n; ++i) free_impl(ptrs[i]);
+    os_mutex_unlock(&g_heap_lock);
+}
+
+// co-allocation: lay n sub-objects out back to back in one block
+void *j_malloc_multi(const size_t *sizes, const size_t *aligns, size_t n, void **out_ptrs) {
+    if (!sizes || !out_ptrs || n == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    // offsets relative to a base aligned to the strictest requested alignment
+    size_t max_align = ALIGNMENT;
+    size_t off = 0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t a = aligns && aligns[i] ? aligns[i] : ALIGNMENT;
+        if (a & (a - 1)) {
+            errno = EINVAL;
+            return NULL;
+        }
+        if (a > max_align) max_align = a;
+        size_t start = ALIGN_UP(off, a);
+        if (start < off || start + sizes[i] < start) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        off = start + sizes[i];
+    }
+    // payloads are only ALIGNMENT aligned, so stricter layouts need room to slide
+    size_t slack = max_align - ALIGNMENT;
+    if (off + slack < off) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    uint8_t *block = (uint8_t*)malloc_from((off ? off : 1) + slack, 0, J_RETURN_ADDRESS());
+    if (!block) return NULL;
+    uint8_t *base = (uint8_t*)ALIGN_UP((uintptr_t)block, max_align);
+
+    off = 0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t a = aligns && aligns[i] ? aligns[i] : ALIGNMENT;
+        off = ALIGN_UP(off, a);
+        out_ptrs[i] = base + off;
+        off += sizes[i];
+    }
+    return block;
+}
+
+void j_set_hooks(const j_hooks_t *hooks) {
+    // drop the flag first so no operation sees a half-written table
+    g_hooks_active = 0;
+    if (!hooks) {
+        memset(&g_hooks, 0, sizeof(g_hooks));
+        g_hooks_set = 0;
+        g_hooks_active = g_trace_fp != NULL;
+        return;
+    }
+    g_hooks = *hooks;
+    g_hooks_set = 1;
+    g_hooks_active = 1;
+}
+
+int j_trace_start(const char *path) {
+    if (!path) {
+        errno = EINVAL;
+        return -1;
+    }
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    fputs("# jmalloc trace v1\n", f);
+    os_mutex_lock(&g_heap_lock);
+    FILE *old = g_trace_fp;
+    g_trace_fp = f;
+    g_hooks_active = 1;
+    os_mutex_unlock(&g_heap_lock);
+    if (old) fclose(old);
+    return 0;
+}
+
+void j_trace_stop() {
+    os_mutex_lock(&g_heap_lock);
+    FILE *f = g_trace_fp;
+    g_trace_fp = NULL;
+    g_hooks_active = g_hooks_set;
+    os_mutex_unlock(&g_heap_lock);
+    if (f) fclose(f);
+}
+
+// main malloc function
+static void *malloc_impl(size_t size, unsigned tag, unsigned group, unsigned site) {
+    return alloc_impl(size, tag, group, site, 0, NULL);
+}
+
+// with want_zero (calloc) a known-zero block is preferred, and *zeroed says
+// whether the payload handed out is already all zero
+static void *alloc_impl(size_t size, unsigned tag, unsigned group, unsigned site, int want_zero, int *zeroed) {
     if (size == 0) return NULL;
     size = ALIGN_UP(size, ALIGNMENT);
+    if (J_UNLIKELY(g_sc_window)) sizeclass_record(size);
+    if (size <= g_sc_limit) size = g_sc_round[size / ALIGNMENT - 1];
 
-    block_header_t *blk = find_first_fit(size);
-    // first fit not found
+    heap_t *h = &g_heaps[group];
+    block_header_t *blk = want_zero ? zero_find(h, size) : NULL;
+    if (!blk) blk = g_policy->find(h, size);
+    // another heap's empty arena before a new one
+    if (!blk && J_UNLIKELY(g_site_groups || g_thread_heaps)) blk = steal_arena(h, size);
+    // no fit found
     if (!blk) {
-        blk = request_space(size);
-        if (!blk) return NULL;
+        account_grow();
+        blk = request_space(h, size);
+        if (!blk) {
+            fr_record(FR_ALLOC_FAIL, size, (unsigned long long)errno);
+            return NULL;
+        }
     } 
     // found
     else {
         size_t old_size = blk->size;
+        free_index_remove(h, blk);
         if (old_size >= size + header_size() + ALIGNMENT) {
             split_block(blk, size);
         }
@@ -109,20 +1478,33 @@ void *j_malloc(size_t size) {
         // reduce free bytes count
         g_free_bytes -= old_size;
     }
+    if (zeroed) *zeroed = (blk->flags & BLK_ZERO) != 0;
+    blk->tag = (unsigned short)tag;
+    blk->flags = 0;
+    blk->site = (unsigned short)site;
+    account_alloc(blk);
+    if (J_UNLIKELY(size >= FR_LARGE_ALLOC)) fr_record(FR_LARGE, (uintptr_t)blk + header_size(), size);
 
     // return pointer to payload (after header)
     return (void*)((uint8_t*)blk + header_size());
 }
 
 // free function
-void j_free(void *ptr) {
+static void free_impl(void *ptr) {
     // if null pointer, do nothing
     if (!ptr) return;
     // payload pointer ptr -> block header pointer blk
     block_header_t *blk = (block_header_t*)((uint8_t*)ptr - header_size());
-    //if already free, do nothing
-    if (blk->free) return;
+    //if already free (or parked in a thread cache), do nothing
+    if (blk->free || (blk->flags & (BLK_CACHED | BLK_ZEROING))) return;
+    account_free(blk);
+    release_block(blk);
+}
+
+// hand a block that has left the live set back to the heap
+static void release_block(block_header_t *blk) {
     blk->free = 1;
+    blk->flags = 0;
     // increase free bytes count
     g_free_bytes += blk->size;
     // try to merge with adjacent free blocks
@@ -130,18 +1512,20 @@ void j_free(void *ptr) {
 }
 
 // realloc function
-// realloc is to resize an allocated memory block
-void *j_realloc(void *ptr, size_t new_size) {
+// realloc is to resize an allocated memory block; group and site are the
+// caller's origin, used only when ptr is NULL
+static void *realloc_impl(void *ptr, size_t new_size, unsigned group, unsigned site) {
     // if ptr is NULL, behave like malloc
-    if (!ptr) return j_malloc(new_size);
+    if (!ptr) return malloc_impl(new_size, 0, group, site);
     // if new_size is 0, behave like free and return NULL
     if (new_size == 0) { 
-        j_free(ptr);
+        free_impl(ptr);
         return NULL; 
     }
 
     // align new_size
     new_size = ALIGN_UP(new_size, ALIGNMENT);
+    if (new_size <= g_sc_limit) new_size = g_sc_round[new_size / ALIGNMENT - 1];
     // get block header from payload pointer
     block_header_t *blk = (block_header_t*)((uint8_t*)ptr - header_size());
     size_t old_size = blk->size;
@@ -151,93 +1535,2245 @@ void *j_realloc(void *ptr, size_t new_size) {
     if (old_size >= new_size) {
         if (old_size >= new_size + header_size() + ALIGNMENT) {
             split_block(blk, new_size);
+            account_resize(blk, old_size);
         }
         return ptr;
     }
 
-    // if the next block exists and is free, and if merging with it can satisfy new_size
-    if (blk->next && blk->next->free && (old_size + header_size() + blk->next->size) >= new_size) {
+    // if the next block exists, is free and sits right after us in memory, and if merging with it can satisfy new_size
+    if (blk->next && blk->next->free && blocks_adjacent(blk, blk->next) &&
+        (old_size + header_size() + blk->next->size) >= new_size) {
         block_header_t *n = blk->next;
+        free_index_remove(heap_of(blk), n);
         // merge sizes
         blk->size += header_size() + n->size;
         blk->next = n->next;
         if (blk->next) blk->next->prev = blk; 
-        else g_tail = blk;
+        else heap_of(blk)->tail = blk;
         g_free_bytes -= n->size;
         // still have extra space, split
         if (blk->size >= new_size + header_size() + ALIGNMENT) {
             split_block(blk, new_size);
         }
+        account_resize(blk, old_size);
         return (void*)((uint8_t*)blk + header_size());
     }
 
     // otherwise, need to allocate a new block
-    void *new_ptr = j_malloc(new_size);
+    // the new block keeps the old block's tag, group and site
+    void *new_ptr = malloc_impl(new_size, blk->tag, blk->group, blk->site);
     if (!new_ptr) return NULL;
     // data copy
     // memcpy(dest, src, n)
     size_t keep = old_size < new_size ? old_size : new_size;
     memcpy(new_ptr, ptr, keep);
     // free old block
-    j_free(ptr);
+    free_impl(ptr);
     return new_ptr;
 }
 
-size_t j_heap_bytes() { 
-    return g_total_bytes; 
-}
-size_t j_free_bytes() {
-    size_t sum = 0;
-    for (block_header_t *cur = g_head; cur; cur = cur->next) {
-        if (cur->free) sum += cur->size;
+// locked entry points into the heap
+// the soft budget callback is owed by whichever operation grew the heap; it
+// runs after the lock is dropped so the callback may free memory itself
+static void heap_unlock(void) {
+    if (J_UNLIKELY(g_budget_soft_pending)) {
+        budget_on_soft_limit(); // drops the lock
+        return;
     }
-    return sum;
+    os_mutex_unlock(&g_heap_lock);
 }
 
-// helpers implementation
-static block_header_t* find_first_fit(size_t size) {
-    // find first fit block in global list
-    for (block_header_t *cur = g_head; cur; cur = cur->next) {
-        // if there is a free block (free = 1) and if its size is larger than or equal to the required size, return the pointer
-        if (cur->free && cur->size >= size) return cur;
+static void *heap_malloc(size_t size, unsigned tag, unsigned group, unsigned site) {
+    os_mutex_lock(&g_heap_lock);
+    void *p = malloc_impl(size, tag, group, site);
+    heap_unlock();
+    return p;
+}
+
+// the memset, when one is needed, runs after the lock is dropped
+static void *heap_calloc(size_t size, unsigned group, unsigned site) {
+    int zeroed = 0;
+    os_mutex_lock(&g_heap_lock);
+    void *p = alloc_impl(size, 0, group, site, 1, &zeroed);
+    heap_unlock();
+    if (!p) return NULL;
+    atomic_fetch_add_explicit(&g_zs_calloc, 1, memory_order_relaxed);
+    if (zeroed) {
+        atomic_fetch_add_explicit(&g_zs_known_zero, size, memory_order_relaxed);
+    } else {
+        memset(p, 0, size);
+        atomic_fetch_add_explicit(&g_zs_memset, size, memory_order_relaxed);
     }
-    // if no fit -> NULL
-    return NULL;
+    return p;
 }
 
-static block_header_t* request_space(size_t size) {
-    // allocate at least ARENA_MIN_SIZE to reduce OS calls
-    size_t need = header_size() + size;
-    // if need is larger than ARENA_MIN_SIZE, allocate need; otherwise allocate ARENA_MIN_SIZE (+ arena header size)
-    size_t arena_total = arena_header_size() + (need > ARENA_MIN_SIZE ? need : ARENA_MIN_SIZE);
+static void heap_free(void *ptr) {
+    if (!ptr) return;
+    os_mutex_lock(&g_heap_lock);
+    free_impl(ptr);
+    os_mutex_unlock(&g_heap_lock);
+}
 
-    // ask OS for memory
-    void* mem = os_alloc(arena_total);
-    if (!mem) return NULL;
+static void *heap_realloc(void *ptr, size_t new_size, unsigned group, unsigned site) {
+    os_mutex_lock(&g_heap_lock);
+    void *p = realloc_impl(ptr, new_size, group, site);
+    heap_unlock();
+    return p;
+}
 
-    // set up arena header
-    // [mem start] -> [arena_header][block_header_t first block][...]
-    arena_header_t* a = (arena_header_t*)mem;
-    a->size = arena_total;
-    a->prev = NULL;
-    // first arena in the global arena list assigned to a->next
-    // then, the first arena in the g_arenas will get a as prev arena
-    // then, set current g_arenas to a (now first)
-    a->next = g_arenas;
-    if (g_arenas) g_arenas->prev = a;
-    g_arenas = a;
+// the same, plus a trace record when tracing; the hooked paths use these.
+// sizes are recorded as requested, the simulator applies its own rounding
+static void *heap_malloc_traced(size_t size, unsigned tag, unsigned group, unsigned site) {
+    os_mutex_lock(&g_heap_lock);
+    void *p = malloc_impl(size, tag, group, site);
+    if (p && g_trace_fp) fprintf(g_trace_fp, "a %p %zu\n", p, size);
+    heap_unlock();
+    return p;
+}
 
-    // first block placed right after arena header; if we reserved a big arena, split to leave a trailing free block
-    uint8_t* base = (uint8_t*)mem + arena_header_size();
-    block_header_t* blk = (block_header_t*)base;
-    blk->prev = g_tail;
-    blk->next = NULL;
+static void heap_free_traced(void *ptr) {
+    if (!ptr) return;
+    os_mutex_lock(&g_heap_lock);
+    block_header_t *blk = (block_header_t*)((uint8_t*)ptr - header_size());
+    if (g_trace_fp && !blk->free) fprintf(g_trace_fp, "f %p\n", ptr);
+    free_impl(ptr);
+    os_mutex_unlock(&g_heap_lock);
+}
+
+static void *heap_realloc_traced(void *ptr, size_t new_size, unsigned group, unsigned site) {
+    os_mutex_lock(&g_heap_lock);
+    void *p = realloc_impl(ptr, new_size, group, site);
+    if (g_trace_fp) {
+        if (!ptr) {
+            if (p) fprintf(g_trace_fp, "a %p %zu\n", p, new_size);
+        } else if (new_size == 0) {
+            fprintf(g_trace_fp, "f %p\n", ptr);
+        } else if (p) {
+            fprintf(g_trace_fp, "r %p %p %zu\n", ptr, p, new_size);
+        }
+    }
+    heap_unlock();
+    return p;
+}
+
+// hooked slow paths, only reached while hooks are installed or a trace runs
+static void *malloc_hooked(size_t size, unsigned tag, unsigned group, unsigned site) {
+    if (t_in_hook) return heap_malloc_traced(size, tag, group, site);
+    t_in_hook = 1;
+    // a pre hook may veto the allocation (quota enforcement)
+    if (g_hooks.pre_malloc && g_hooks.pre_malloc(size, g_hooks.ctx) != 0) {
+        t_in_hook = 0;
+        return NULL;
+    }
+    t_in_hook = 0;
+    void *p = heap_malloc_traced(size, tag, group, site);
+    t_in_hook = 1;
+    if (g_hooks.post_malloc) g_hooks.post_malloc(p, size, g_hooks.ctx);
+    t_in_hook = 0;
+    return p;
+}
+
+static void free_hooked(void *ptr) {
+    if (t_in_hook) { heap_free_traced(ptr); return; }
+    t_in_hook = 1;
+    if (g_hooks.pre_free) g_hooks.pre_free(ptr, g_hooks.ctx);
+    t_in_hook = 0;
+    heap_free_traced(ptr);
+    t_in_hook = 1;
+    if (g_hooks.post_free) g_hooks.post_free(ptr, g_hooks.ctx);
+    t_in_hook = 0;
+}
+
+static void *realloc_hooked(void *ptr, size_t new_size, unsigned group, unsigned site) {
+    if (t_in_hook) return heap_realloc_traced(ptr, new_size, group, site);
+    t_in_hook = 1;
+    if (g_hooks.pre_realloc && g_hooks.pre_realloc(ptr, new_size, g_hooks.ctx) != 0) {
+        t_in_hook = 0;
+        return NULL;
+    }
+    t_in_hook = 0;
+    void *p = heap_realloc_traced(ptr, new_size, group, site);
+    t_in_hook = 1;
+    if (g_hooks.post_realloc) g_hooks.post_realloc(ptr, p, new_size, g_hooks.ctx);
+    t_in_hook = 0;
+    return p;
+}
+
+size_t j_heap_bytes() { 
+    return g_total_bytes; 
+}
+
+size_t j_tag_usage(j_tag_usage_t *out, size_t max) {
+    // sum every live thread plus the retired totals
+    j_tag_usage_t sum[J_MAX_TAGS];
+    memset(sum, 0, sizeof(sum));
+    os_mutex_lock(&g_threads_lock);
+    for (int t = 0; t < J_MAX_TAGS; ++t) {
+        long long live = g_retired.tags[t].live_bytes;
+        unsigned long long allocs = g_retired.tags[t].allocs;
+        unsigned long long frees = g_retired.tags[t].frees;
+        for (thread_state_t *ts = g_threads; ts; ts = ts->next) {
+            live += atomic_load_explicit(&ts->tags[t].live_bytes, memory_order_relaxed);
+            allocs += atomic_load_explicit(&ts->tags[t].allocs, memory_order_relaxed);
+            frees += atomic_load_explicit(&ts->tags[t].frees, memory_order_relaxed);
+        }
+        sum[t].tag = (unsigned)t;
+        sum[t].live_bytes = live;
+        sum[t].live_count = (long long)(allocs - frees);
+        sum[t].total_allocs = allocs;
+    }
+    os_mutex_unlock(&g_threads_lock);
+
+    // report only tags that have ever been used
+    size_t n = 0;
+    for (int t = 0; t < J_MAX_TAGS; ++t) {
+        if (sum[t].total_allocs == 0) continue;
+        if (n < max) out[n] = sum[t];
+        n++;
+    }
+    return n;
+}
+
+void j_thread_name(const char *name) {
+    thread_state_t *ts = thread_state();
+    if (!ts) return;
+    size_t len = name ? strlen(name) : 0;
+    if (len >= sizeof(ts->name)) len = sizeof(ts->name) - 1;
+    os_mutex_lock(&g_threads_lock);
+    if (len) memcpy(ts->name, name, len);
+    ts->name[len] = 0;
+    os_mutex_unlock(&g_threads_lock);
+}
+
+static void thread_stats_fill(j_thread_stats_t *o, const thread_counters_t *c) {
+    o->allocs = atomic_load_explicit(&c->allocs, memory_order_relaxed);
+    o->frees = atomic_load_explicit(&c->frees, memory_order_relaxed);
+    o->bytes_allocated = atomic_load_explicit(&c->bytes_allocated, memory_order_relaxed);
+    o->bytes_freed = atomic_load_explicit(&c->bytes_freed, memory_order_relaxed);
+    o->remote_frees = atomic_load_explicit(&c->remote_frees, memory_order_relaxed);
+    o->heap_grows = atomic_load_explicit(&c->heap_grows, memory_order_relaxed);
+}
+
+size_t j_thread_stats(j_thread_stats_t *out, size_t max) {
+    size_t n = 0;
+    os_mutex_lock(&g_threads_lock);
+    // oldest thread first: the registry is pushed at the head
+    thread_state_t *last = g_threads;
+    while (last && last->next) last = last->next;
+    for (thread_state_t *ts = last; ts; ts = ts->prev, ++n) {
+        if (n >= max) continue;
+        out[n].id = ts->id;
+        memcpy(out[n].name, ts->name, sizeof(out[n].name));
+        thread_stats_fill(&out[n], &ts->counters);
+        out[n].tcache_bytes = atomic_load_explicit(&ts->tc_bytes, memory_order_relaxed);
+        out[n].tcache_capacity_bytes = atomic_load_explicit(&ts->tc_cap_bytes, memory_order_relaxed);
+    }
+    if (atomic_load_explicit(&g_retired.counters.allocs, memory_order_relaxed) ||
+        atomic_load_explicit(&g_retired.counters.frees, memory_order_relaxed)) {
+        if (n < max) {
+            out[n].id = 0;
+            memcpy(out[n].name, "(exited)", sizeof("(exited)"));
+            thread_stats_fill(&out[n], &g_retired.counters);
+            out[n].tcache_bytes = out[n].tcache_capacity_bytes = 0;
+        }
+        n++;
+    }
+    os_mutex_unlock(&g_threads_lock);
+    return n;
+}
+
+void j_thread_cache(size_t budget_bytes) {
+    os_mutex_lock(&g_heap_lock);
+    g_tc_budget = budget_bytes;
+    tc_set_limit();
+    tc_update_active();
+    os_mutex_unlock(&g_heap_lock);
+    if (atomic_load_explicit(&g_tc_stale, memory_order_relaxed)) tc_sync();
+}
+
+void j_thread_cache_flush() {
+    if (t_state) tc_flush(t_state, 0);
+}
+
+static void tcache_class_add(j_tcache_class_t *o, const tc_bin_t *b) {
+    o->hits += atomic_load_explicit(&b->hits, memory_order_relaxed);
+    o->misses += atomic_load_explicit(&b->misses, memory_order_relaxed);
+    o->overflows += atomic_load_explicit(&b->overflows, memory_order_relaxed);
+}
+
+void j_tcache_stats(j_tcache_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->budget = g_tc_budget;
+    out->capacity_bytes = atomic_load_explicit(&g_tc_cap_total, memory_order_relaxed);
+    out->steals = atomic_load_explicit(&g_tc_steals, memory_order_relaxed);
+    for (unsigned c = 0; c < TC_CLASSES; ++c) out->classes[c].size = tc_class_bytes(c);
+    os_mutex_lock(&g_threads_lock);
+    for (thread_state_t *ts = g_threads; ts; ts = ts->next) {
+        out->threads++;
+        out->cached_bytes += atomic_load_explicit(&ts->tc_bytes, memory_order_relaxed);
+        for (unsigned c = 0; c < TC_CLASSES; ++c) {
+            j_tcache_class_t *o = &out->classes[c];
+            o->capacity += atomic_load_explicit(&ts->tc[c].cap, memory_order_relaxed);
+            o->cached += atomic_load_explicit(&ts->tc[c].count, memory_order_relaxed);
+            unsigned cap = atomic_load_explicit(&ts->tc[c].cap, memory_order_relaxed);
+            if (cap > o->max_capacity) o->max_capacity = cap;
+            tcache_class_add(o, &ts->tc[c]);
+        }
+    }
+    for (unsigned c = 0; c < TC_CLASSES; ++c) {
+        j_tcache_class_t *o = &out->classes[c];
+        tcache_class_add(o, &g_retired.tc[c]);
+        out->hits += o->hits;
+        out->misses += o->misses;
+        out->overflows += o->overflows;
+    }
+    os_mutex_unlock(&g_threads_lock);
+}
+
+// purge: hand the whole pages inside free blocks back to the OS
+size_t j_purge() {
+    os_mutex_lock(&g_heap_lock);
+    size_t n = purge_free_blocks(1);
+    os_mutex_unlock(&g_heap_lock);
+    return n;
+}
+
+// batched purging
+// ranges are queued, then sorted by address, merged where they touch and
+// handed to os_purge_vec together (process_madvise where the kernel allows it),
+// rather than one madvise per free block
+#define PURGE_BATCH 512
+typedef struct purge_batch {
+    size_t n;
+    os_range_t r[PURGE_BATCH];
+} purge_batch_t;
+
+static _Atomic unsigned long long g_purge_bytes = 0;
+static _Atomic unsigned long long g_purge_ranges = 0;  // as queued, before merging
+static _Atomic unsigned long long g_purge_syscalls = 0;
+
+static int cmp_range(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)((const os_range_t*)a)->p, y = (uintptr_t)((const os_range_t*)b)->p;
+    return x < y ? -1 : x > y;
+}
+
+// purge and empty the batch. 0, or -1 if any range may still be resident
+static int purge_batch_flush(purge_batch_t *b) {
+    if (b->n == 0) return 0;
+    size_t queued = b->n, bytes = 0, m = 0;
+    qsort(b->r, b->n, sizeof(os_range_t), cmp_range);
+    for (size_t i = 0; i < b->n; ++i) {
+        bytes += b->r[i].n;
+        if (m && (uint8_t*)b->r[m - 1].p + b->r[m - 1].n == (uint8_t*)b->r[i].p) b->r[m - 1].n += b->r[i].n;
+        else b->r[m++] = b->r[i];
+    }
+    unsigned long long calls = 0;
+    int rc = os_purge_vec(b->r, m, &calls);
+    b->n = 0;
+    fr_record(FR_PURGE, rc == 0 ? bytes : 0, m);
+    atomic_fetch_add_explicit(&g_purge_syscalls, calls, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_purge_ranges, queued, memory_order_relaxed);
+    if (rc == 0) atomic_fetch_add_explicit(&g_purge_bytes, bytes, memory_order_relaxed);
+    return rc;
+}
+
+// the whole pages of a payload, or 0 if there are none
+static size_t payload_pages(const block_header_t *blk, size_t ps, uint8_t **lo) {
+    uintptr_t payload = (uintptr_t)blk + header_size();
+    uintptr_t l = ALIGN_UP(payload, ps);
+    uintptr_t hi = (payload + blk->size) & ~(uintptr_t)(ps - 1);
+    *lo = (uint8_t*)l;
+    return hi > l ? hi - l : 0;
+}
+
+// blocks queued by purge_free_blocks, flagged once their batch is flushed
+typedef struct purge_pending {
+    purge_batch_t batch;
+    block_header_t *blk[PURGE_BATCH];
+    size_t queued;  // bytes in the batch
+    size_t purged;  // bytes flushed successfully
+} purge_pending_t;
+static purge_pending_t g_purge_pending; // under the heap lock
+
+static void purge_pending_flush(purge_pending_t *pp) {
+    size_t n = pp->batch.n;
+    int ok = purge_batch_flush(&pp->batch) == 0;
+    for (size_t i = 0; i < n; ++i) {
+        block_header_t *cur = pp->blk[i];
+        int zero = (cur->flags & BLK_ZERO) != 0;
+        // a failed batch leaves its blocks unflagged: which ranges went is unknown
+        if (ok) cur->flags |= BLK_PURGED;
+        // where purged pages are not refilled with zeros, even an attempt spoils the flag
+        if (!OS_PURGE_ZEROES) cur->flags &= ~BLK_ZERO;
+        if (zero) free_index_insert(heap_of(cur), cur);
+    }
+    if (ok) pp->purged += pp->queued;
+    pp->queued = 0;
+}
+
+// purge only free blocks spanning at least min_pages whole pages
+static size_t purge_free_blocks(size_t min_pages) {
+    size_t ps = os_pagesize();
+    purge_pending_t *pp = &g_purge_pending;
+    pp->purged = 0;
+    for (heap_t *h = g_heaps; h < g_heaps + J_MAX_SITE_GROUPS; ++h) {
+        for (block_header_t *cur = h->head; cur; cur = cur->next) {
+            if (!cur->free || (cur->flags & BLK_PURGED)) continue;
+            // keep the header page resident, release only pages fully inside the payload
+            uint8_t *lo;
+            size_t len = payload_pages(cur, ps, &lo);
+            if (len == 0 || len / ps < min_pages) continue;
+            // a known-zero block leaves the index until its batch is flushed:
+            // purging may drop its list links
+            if (cur->flags & BLK_ZERO) free_index_remove(h, cur);
+            pp->blk[pp->batch.n] = cur;
+            pp->batch.r[pp->batch.n].p = lo;
+            pp->batch.r[pp->batch.n].n = len;
+            pp->batch.n++;
+            pp->queued += len;
+            if (pp->batch.n == PURGE_BATCH) purge_pending_flush(pp);
+        }
+    }
+    purge_pending_flush(pp);
+    return pp->purged;
+}
+
+void j_purge_stats(j_purge_stats_t *out) {
+    out->bytes_purged = atomic_load_explicit(&g_purge_bytes, memory_order_relaxed);
+    out->ranges = atomic_load_explicit(&g_purge_ranges, memory_order_relaxed);
+    out->syscalls = atomic_load_explicit(&g_purge_syscalls, memory_order_relaxed);
+    out->syscalls_per_gb = out->bytes_purged ? (double)out->syscalls * (double)(1u << 30) / (double)out->bytes_purged : 0.0;
+    out->batched = os_purge_vec_batched();
+}
+
+int j_set_policy(j_policy_t policy) {
+    if ((unsigned)policy >= J_POLICY_COUNT) {
+        errno = EINVAL;
+        return -1;
+    }
+    os_mutex_lock(&g_heap_lock);
+    policy_activate(&k_policies[policy]);
+    os_mutex_unlock(&g_heap_lock);
+    return 0;
+}
+
+j_policy_t j_get_policy() {
+    os_mutex_lock(&g_heap_lock);
+    j_policy_t p = (j_policy_t)(g_policy - k_policies);
+    os_mutex_unlock(&g_heap_lock);
+    return p;
+}
+
+const char *j_policy_name(j_policy_t policy) {
+    if ((unsigned)policy >= J_POLICY_COUNT) return NULL;
+    return k_policies[policy].name;
+}
+
+// size classes
+static int sizeclass_valid(const size_t *classes, size_t n) {
+    if (n > J_SIZECLASS_MAX_COUNT || (n && !classes)) return 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (classes[i] == 0 || classes[i] % ALIGNMENT || classes[i] > J_SIZECLASS_MAX_BYTES) return 0;
+        if (i && classes[i] <= classes[i - 1]) return 0;
+    }
+    return 1;
+}
+
+// swap in a validated table
+static void sizeclass_install(const size_t *classes, size_t n) {
+    g_sc_limit = 0; // no rounding while the lookup table is rebuilt
+    g_sc_count = n;
+    if (n == 0) return;
+    memcpy(g_sc_table, classes, n * sizeof(size_t));
+    size_t c = 0;
+    for (size_t size = ALIGNMENT; size <= classes[n - 1]; size += ALIGNMENT) {
+        while (classes[c] < size) c++;
+        g_sc_round[size / ALIGNMENT - 1] = (uint32_t)classes[c];
+    }
+    g_sc_limit = classes[n - 1];
+}
+
+static void sizeclass_record(size_t size) {
+    if (size <= J_SIZECLASS_MAX_BYTES) g_sc_hist[size / ALIGNMENT - 1]++;
+    if (--g_sc_window == 0) {
+        size_t classes[J_SIZECLASS_MAX_COUNT];
+        size_t n = j_sizeclass_derive(g_sc_hist, g_sc_tune_classes, classes, NULL);
+        if (n) sizeclass_install(classes, n);
+    }
+}
+
+// parse a saved table: one class per line, '#' starts a comment
+static int sizeclass_read_file(const char *path, size_t *classes, size_t *n_out) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char line[64];
+    size_t n = 0;
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), f)) {
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') continue;
+        char *end;
+        unsigned long long v = strtoull(p, &end, 10);
+        if (end == p || n == J_SIZECLASS_MAX_COUNT) ok = 0;
+        else classes[n++] = (size_t)v;
+    }
+    fclose(f);
+    if (!ok || !sizeclass_valid(classes, n)) {
+        errno = EINVAL;
+        return -1;
+    }
+    *n_out = n;
+    return 0;
+}
+
+// JMALLOC_SIZE_CLASSES is consulted once, when the heap first grows
+static void sizeclass_init_from_env(void) {
+    g_sc_env_read = 1;
+    const char *path = getenv("JMALLOC_SIZE_CLASSES");
+    size_t classes[J_SIZECLASS_MAX_COUNT];
+    size_t n;
+    if (path && sizeclass_read_file(path, classes, &n) == 0) sizeclass_install(classes, n);
+}
+
+int j_sizeclass_set(const size_t *classes, size_t n) {
+    if (!sizeclass_valid(classes, n)) {
+        errno = EINVAL;
+        return -1;
+    }
+    os_mutex_lock(&g_heap_lock);
+    sizeclass_install(classes, n);
+    g_sc_env_read = 1; // an explicit table wins over the environment
+    os_mutex_unlock(&g_heap_lock);
+    return 0;
+}
+
+size_t j_sizeclass_get(size_t *out, size_t max) {
+    os_mutex_lock(&g_heap_lock);
+    size_t n = g_sc_count;
+    if (out) memcpy(out, g_sc_table, (n < max ? n : max) * sizeof(size_t));
+    os_mutex_unlock(&g_heap_lock);
+    return n;
+}
+
+// dynamic programming over the sizes that occur: with sizes v[0..m) and counts
+// w, covering v[j..i] by one class of size v[i] pads by v[i]*W(j..i) - S(j..i)
+// (W, S prefix sums of w and w*v), and best[k][i] = min over j of
+// best[k-1][j-1] + pad(j, i). O(k * m^2) for m <= J_SIZECLASS_BINS sizes.
+size_t j_sizeclass_derive(const unsigned long long *hist, size_t max_classes, size_t *out, double *waste_out) {
+    if (!hist || !out || max_classes == 0) {
+        errno = EINVAL;
+        return 0;
+    }
+    if (max_classes > J_SIZECLASS_MAX_COUNT) max_classes = J_SIZECLASS_MAX_COUNT;
+    double v[J_SIZECLASS_BINS], W[J_SIZECLASS_BINS + 1], S[J_SIZECLASS_BINS + 1];
+    size_t m = 0;
+    W[0] = S[0] = 0;
+    for (size_t b = 0; b < J_SIZECLASS_BINS; ++b) {
+        if (!hist[b]) continue;
+        v[m] = (double)((b + 1) * ALIGNMENT);
+        W[m + 1] = W[m] + (double)hist[b];
+        S[m + 1] = S[m] + (double)hist[b] * v[m];
+        m++;
+    }
+    if (m == 0) {
+        if (waste_out) *waste_out = 0;
+        return 0;
+    }
+    size_t k_max = max_classes < m ? max_classes : m;
+
+    // choice[k][i]: first size covered by the last of k + 1 classes ending at i
+    size_t choice_bytes = k_max * m * sizeof(uint16_t);
+    uint16_t *choice = (uint16_t*)os_alloc(choice_bytes);
+    if (!choice) return 0;
+    double prev[J_SIZECLASS_BINS], cur[J_SIZECLASS_BINS];
+    for (size_t i = 0; i < m; ++i) {
+        prev[i] = v[i] * W[i + 1] - S[i + 1];
+        choice[i] = 0;
+    }
+    for (size_t k = 1; k < k_max; ++k) {
+        for (size_t i = 0; i < m; ++i) {
+            if (i < k) { // fewer sizes than classes: one class per size so far
+                cur[i] = 0;
+                choice[k * m + i] = (uint16_t)i;
+                continue;
+            }
+            double best = -1;
+            size_t best_j = k;
+            for (size_t j = k; j <= i; ++j) {
+                double c = prev[j - 1] + v[i] * (W[i + 1] - W[j]) - (S[i + 1] - S[j]);
+                if (best < 0 || c < best) {
+                    best = c;
+                    best_j = j;
+                }
+            }
+            cur[i] = best;
+            choice[k * m + i] = (uint16_t)best_j;
+        }
+        memcpy(prev, cur, m * sizeof(double));
+    }
+
+    // walk back from the largest size
+    size_t i = m - 1;
+    for (size_t k = k_max; k-- > 0;) {
+        out[k] = (size_t)v[i];
+        size_t j = choice[k * m + i];
+        if (k) i = j - 1;
+    }
+    if (waste_out) *waste_out = prev[m - 1] / S[m];
+    os_free(choice, choice_bytes);
+    return k_max;
+}
+
+int j_sizeclass_autotune(unsigned long long window, size_t max_classes) {
+    if (window == 0 || max_classes == 0 || max_classes > J_SIZECLASS_MAX_COUNT) {
+        errno = EINVAL;
+        return -1;
+    }
+    os_mutex_lock(&g_heap_lock);
+    memset(g_sc_hist, 0, sizeof(g_sc_hist));
+    g_sc_tune_classes = max_classes;
+    g_sc_window = window;
+    os_mutex_unlock(&g_heap_lock);
+    return 0;
+}
+
+void j_sizeclass_histogram(unsigned long long *out) {
+    os_mutex_lock(&g_heap_lock);
+    memcpy(out, g_sc_hist, sizeof(g_sc_hist));
+    os_mutex_unlock(&g_heap_lock);
+}
+
+int j_sizeclass_save(const char *path) {
+    size_t classes[J_SIZECLASS_MAX_COUNT];
+    size_t n = j_sizeclass_get(classes, J_SIZECLASS_MAX_COUNT);
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    fprintf(f, "# jmalloc size classes (%zu)\n", n);
+    for (size_t i = 0; i < n; ++i) fprintf(f, "%zu\n", classes[i]);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+int j_sizeclass_load(const char *path) {
+    size_t classes[J_SIZECLASS_MAX_COUNT];
+    size_t n;
+    if (sizeclass_read_file(path, classes, &n) != 0) return -1;
+    return j_sizeclass_set(classes, n);
+}
+
+// trim: unmap arenas that hold nothing but one free block
+size_t j_trim() {
+    os_mutex_lock(&g_heap_lock);
+    size_t n = trim_arenas(0);
+    os_mutex_unlock(&g_heap_lock);
+    return n;
+}
+
+// an arena that holds nothing but one free block
+static inline int arena_is_empty(const arena_header_t *a) {
+    const block_header_t *blk = a->first_block;
+    return blk->free && blk->size == a->size - arena_header_size() - header_size();
+}
+
+// take an empty arena and its one free block out of h
+static void arena_unlink(heap_t *h, arena_header_t *a) {
+    block_header_t *blk = a->first_block;
+    free_index_remove(h, blk);
+    if (blk->prev) blk->prev->next = blk->next;
+    else h->head = blk->next;
+    if (blk->next) blk->next->prev = blk->prev;
+    else h->tail = blk->prev;
+    if (a->prev) a->prev->next = a->next;
+    else h->arenas = a->next;
+    if (a->next) a->next->prev = a->prev;
+}
+
+// work stealing between heaps: rather than map a new arena, h takes an empty
+// arena from the heap with the most bytes sitting in empty arenas (the
+// smallest of its arenas that fits). returns the arena's free block, already
+// indexed in h, or NULL
+static block_header_t* steal_arena(heap_t *h, size_t size) {
+    heap_t *victim = NULL;
+    arena_header_t *pick = NULL;
+    size_t most = 0;
+    for (heap_t *o = g_heaps; o < g_heaps + J_MAX_SITE_GROUPS; ++o) {
+        if (o == h) continue;
+        size_t surplus = 0;
+        arena_header_t *fit = NULL;
+        for (arena_header_t *a = o->arenas; a; a = a->next) {
+            if (!arena_is_empty(a)) continue;
+            surplus += a->size;
+            if (a->first_block->size >= size && (!fit || a->size < fit->size)) fit = a;
+        }
+        if (fit && surplus > most) {
+            most = surplus;
+            victim = o;
+            pick = fit;
+        }
+    }
+    if (!pick) return NULL;
+    arena_unlink(victim, pick);
+    // the arena goes to the front of h's arenas, as request_space does, and
+    // its block to the end of h's list
+    pick->prev = NULL;
+    pick->next = h->arenas;
+    if (h->arenas) h->arenas->prev = pick;
+    h->arenas = pick;
+    block_header_t *blk = pick->first_block;
+    blk->group = (unsigned char)(h - g_heaps);
+    blk->next = NULL;
+    blk->prev = h->tail;
+    if (h->tail) h->tail->next = blk;
+    else h->head = blk;
+    h->tail = blk;
+    free_index_insert(h, blk);
+    g_steals++;
+    g_stolen_bytes += pick->size;
+    return blk;
+}
+
+// unmap all but the first `retain` entirely free arenas
+static size_t trim_arenas(size_t retain) {
+    size_t released = 0;
+    size_t kept = 0;
+    for (heap_t *h = g_heaps; h < g_heaps + J_MAX_SITE_GROUPS; ++h) {
+        arena_header_t *a = h->arenas;
+        while (a) {
+            arena_header_t *next = a->next;
+            block_header_t *blk = a->first_block;
+            if (arena_is_empty(a)) {
+                if (kept < retain) {
+                    kept++;
+                    a = next;
+                    continue;
+                }
+                arena_unlink(h, a);
+                g_free_bytes -= blk->size;
+                g_total_bytes -= a->size;
+                released += a->size;
+                if (a->buf_index >= 0) uring_unregister_arena(a);
+                fr_record(FR_ARENA_UNMAP, (uintptr_t)a, a->size);
+                os_free(a, a->size);
+            }
+            a = next;
+        }
+    }
+    // re-arm the soft limit once we are back under it
+    if (g_budget_soft_crossed && g_total_bytes <= g_budget_soft) g_budget_soft_crossed = 0;
+    return released;
+}
+
+void j_set_budget(size_t soft_limit, size_t hard_limit, j_budget_cb cb, void *ctx) {
+    os_mutex_lock(&g_heap_lock);
+    g_budget_soft = soft_limit;
+    g_budget_hard = hard_limit;
+    g_budget_cb = cb;
+    g_budget_ctx = ctx;
+    g_budget_soft_crossed = 0;
+    g_budget_soft_pending = 0;
+    g_budget_active = soft_limit != 0 || hard_limit != 0;
+    os_mutex_unlock(&g_heap_lock);
+}
+
+// decide whether the heap may grow by n bytes
+static int budget_admit(size_t n) {
+    if (g_budget_hard && g_total_bytes + n > g_budget_hard) {
+        // cached free arenas are the only thing we can drop without the app's help
+        trim_arenas(0);
+        if (g_total_bytes + n > g_budget_hard) {
+            errno = ENOMEM;
+            return 0;
+        }
+    }
+    if (g_budget_soft && !g_budget_soft_crossed && g_total_bytes + n > g_budget_soft) {
+        g_budget_soft_crossed = 1;
+        g_budget_soft_pending = 1;
+        fr_record(FR_SOFT_LIMIT, g_total_bytes + n, g_budget_soft);
+    }
+    return 1;
+}
+
+// runs after the growing allocation completed, with the heap lock held. the
+// callback and its context are read together under the lock, then the lock
+// is dropped, so the callback may use the allocator
+static void budget_on_soft_limit(void) {
+    g_budget_soft_pending = 0;
+    j_budget_cb cb = g_budget_cb;
+    void *ctx = g_budget_ctx;
+    size_t heap = g_total_bytes, soft = g_budget_soft;
+    os_mutex_unlock(&g_heap_lock);
+    if (cb) cb(heap, soft, ctx);
+    os_mutex_lock(&g_heap_lock);
+    purge_free_blocks(1);
+    trim_arenas(0);
+    os_mutex_unlock(&g_heap_lock);
+}
+
+static void copy_path(char *dst, const char *src, const char *fallback) {
+    snprintf(dst, PRESSURE_PATH_MAX, "%s", src ? src : fallback);
+}
+
+int j_pressure_enable(const j_pressure_config_t *cfg) {
+    j_pressure_config_t c;
+    memset(&c, 0, sizeof(c));
+    if (cfg) c = *cfg;
+    copy_path(g_psi_path, c.psi_path, "/proc/pressure/memory");
+    copy_path(g_cg_current_path, c.cgroup_current_path, "/sys/fs/cgroup/memory.current");
+    copy_path(g_cg_high_path, c.cgroup_high_path, "/sys/fs/cgroup/memory.high");
+    if (c.psi_moderate <= 0) c.psi_moderate = 5.0;
+    if (c.psi_high <= 0) c.psi_high = 20.0;
+    if (c.usage_moderate <= 0) c.usage_moderate = 0.80;
+    if (c.usage_high <= 0) c.usage_high = 0.90;
+    if (c.usage_critical <= 0) c.usage_critical = 0.97;
+    os_mutex_lock(&g_heap_lock);
+    g_pressure_cfg = c;
+    g_pressure_last_ms = 0;
+    g_pressure_enabled = 1;
+    int level = (int)pressure_poll_impl();
+    os_mutex_unlock(&g_heap_lock);
+    return level;
+}
+
+void j_pressure_disable() {
+    os_mutex_lock(&g_heap_lock);
+    g_pressure_enabled = 0;
+    g_pressure_level = J_PRESSURE_NONE;
+    tc_set_limit();
+    os_mutex_unlock(&g_heap_lock);
+}
+
+// "some avg10=1.23 ..." -> 1.23; returns -1 when the file is missing or unreadable
+static double read_psi_some_avg10(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1.0;
+    char line[256];
+    double avg10 = -1.0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "some avg10=%lf", &avg10) == 1) break;
+    }
+    fclose(f);
+    return avg10;
+}
+
+// a cgroup memory file holds a byte count or "max"; returns 0 for max / missing
+static unsigned long long read_cgroup_bytes(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    char line[64];
+    unsigned long long v = 0;
+    if (fgets(line, sizeof(line), f) && strncmp(line, "max", 3) != 0) {
+        v = strtoull(line, NULL, 10);
+    }
+    fclose(f);
+    return v;
+}
+
+int j_pressure_poll() {
+    os_mutex_lock(&g_heap_lock);
+    int level = g_pressure_enabled ? (int)pressure_poll_impl() : -1;
+    os_mutex_unlock(&g_heap_lock);
+    return level;
+}
+
+static size_t pressure_poll_impl(void) {
+    g_pressure_last_ms = os_now_ms();
+
+    int level = J_PRESSURE_NONE;
+    double psi = read_psi_some_avg10(g_psi_path);
+    if (psi >= g_pressure_cfg.psi_high) level = J_PRESSURE_HIGH;
+    else if (psi >= g_pressure_cfg.psi_moderate) level = J_PRESSURE_MODERATE;
+
+    unsigned long long high = read_cgroup_bytes(g_cg_high_path);
+    unsigned long long cur = read_cgroup_bytes(g_cg_current_path);
+    if (high) {
+        double usage = (double)cur / (double)high;
+        int cg_level = J_PRESSURE_NONE;
+        if (usage >= g_pressure_cfg.usage_critical) cg_level = J_PRESSURE_CRITICAL;
+        else if (usage >= g_pressure_cfg.usage_high) cg_level = J_PRESSURE_HIGH;
+        else if (usage >= g_pressure_cfg.usage_moderate) cg_level = J_PRESSURE_MODERATE;
+        if (cg_level > level) level = cg_level;
+    }
+    g_pressure_level = level;
+
+    // adapt: the higher the pressure, the smaller the free blocks we purge,
+    // the fewer empty arenas we keep for reuse and the less the thread caches hold
+    tc_set_limit();
+    if (k_purge_min_pages[level]) purge_free_blocks(k_purge_min_pages[level]);
+    if (level != J_PRESSURE_NONE) trim_arenas(k_retain_arenas[level]);
+    return (size_t)level;
+}
+
+int j_pressure_level() {
+    return g_pressure_level;
+}
+
+static void uring_register_arena(arena_header_t *a) {
+    a->buf_index = -1;
+    size_t len = ALIGN_UP(a->size, os_pagesize());
+    if (len > URING_MAX_BUFFER) return;
+    for (unsigned slot = 0; slot < g_uring_nslots; ++slot) {
+        if (g_uring_used[slot]) continue;
+        if (os_uring_update(g_uring_fd, slot, a, len) == 0) {
+            g_uring_used[slot] = 1;
+            a->buf_index = (int)slot;
+        }
+        return;
+    }
+    // table full: the arena still works, its blocks just have no fixed index
+}
+
+static void uring_unregister_arena(arena_header_t *a) {
+    os_uring_update(g_uring_fd, (unsigned)a->buf_index, NULL, 0);
+    g_uring_used[a->buf_index] = 0;
+    a->buf_index = -1;
+}
+
+int j_uring_attach(int ring_fd, unsigned max_buffers) {
+    if (ring_fd < 0 || max_buffers == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    os_mutex_lock(&g_heap_lock);
+    if (g_uring_fd >= 0) {
+        os_mutex_unlock(&g_heap_lock);
+        errno = EBUSY;
+        return -1;
+    }
+    unsigned char *used = (unsigned char*)os_alloc(max_buffers);
+    if (!used) {
+        os_mutex_unlock(&g_heap_lock);
+        return -1;
+    }
+    if (os_uring_register_table(ring_fd, max_buffers) != 0) {
+        int err = errno;
+        os_free(used, max_buffers);
+        os_mutex_unlock(&g_heap_lock);
+        errno = err;
+        return -1;
+    }
+    g_uring_fd = ring_fd;
+    g_uring_nslots = max_buffers;
+    g_uring_used = used;
+    // arenas mapped before attach join the table too
+    for (heap_t *h = g_heaps; h < g_heaps + J_MAX_SITE_GROUPS; ++h) {
+        for (arena_header_t *a = h->arenas; a; a = a->next) uring_register_arena(a);
+    }
+    os_mutex_unlock(&g_heap_lock);
+    return 0;
+}
+
+void j_uring_detach() {
+    os_mutex_lock(&g_heap_lock);
+    if (g_uring_fd >= 0) {
+        os_uring_unregister(g_uring_fd);
+        for (heap_t *h = g_heaps; h < g_heaps + J_MAX_SITE_GROUPS; ++h) {
+            for (arena_header_t *a = h->arenas; a; a = a->next) a->buf_index = -1;
+        }
+        os_free(g_uring_used, g_uring_nslots);
+        g_uring_used = NULL;
+        g_uring_nslots = 0;
+        g_uring_fd = -1;
+    }
+    os_mutex_unlock(&g_heap_lock);
+}
+
+int j_uring_buf_index(const void *ptr) {
+    const uint8_t *p = (const uint8_t*)ptr;
+    int index = -1;
+    os_mutex_lock(&g_heap_lock);
+    for (heap_t *h = g_heaps; h < g_heaps + J_MAX_SITE_GROUPS && index < 0; ++h) {
+        for (arena_header_t *a = h->arenas; a; a = a->next) {
+            if (p >= (const uint8_t*)a && p < (const uint8_t*)a + a->size) {
+                index = a->buf_index;
+                break;
+            }
+        }
+    }
+    os_mutex_unlock(&g_heap_lock);
+    return index;
+}
+
+// index of the span containing p in the sorted span table, or -1
+static long iobuf_span_find(const void *p) {
+    size_t lo = 0, hi = g_iobuf_nspans;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        iobuf_span_t *sp = g_iobuf_spans[mid];
+        if ((const uint8_t*)p < sp->base) hi = mid;
+        else if ((const uint8_t*)p >= sp->base + sp->size) lo = mid + 1;
+        else return (long)mid;
+    }
+    return -1;
+}
+
+static int iobuf_table_insert(iobuf_span_t *sp) {
+    if (g_iobuf_nspans == g_iobuf_cap) {
+        size_t cap = g_iobuf_cap ? g_iobuf_cap * 2 : 512;
+        iobuf_span_t **t = (iobuf_span_t**)os_alloc(cap * sizeof(*t));
+        if (!t) return -1;
+        if (g_iobuf_spans) {
+            memcpy(t, g_iobuf_spans, g_iobuf_nspans * sizeof(*t));
+            os_free(g_iobuf_spans, g_iobuf_cap * sizeof(*t));
+        }
+        g_iobuf_spans = t;
+        g_iobuf_cap = cap;
+    }
+    size_t i = g_iobuf_nspans;
+    while (i > 0 && g_iobuf_spans[i - 1]->base > sp->base) {
+        g_iobuf_spans[i] = g_iobuf_spans[i - 1];
+        i--;
+    }
+    g_iobuf_spans[i] = sp;
+    g_iobuf_nspans++;
+    return 0;
+}
+
+static void iobuf_table_remove(size_t i) {
+    memmove(&g_iobuf_spans[i], &g_iobuf_spans[i + 1], (g_iobuf_nspans - i - 1) * sizeof(*g_iobuf_spans));
+    g_iobuf_nspans--;
+}
+
+static void iobuf_partial_push(iobuf_span_t *sp) {
+    sp->prev_partial = NULL;
+    sp->next_partial = g_iobuf_partial[sp->cls];
+    if (sp->next_partial) sp->next_partial->prev_partial = sp;
+    g_iobuf_partial[sp->cls] = sp;
+}
+
+static void iobuf_partial_remove(iobuf_span_t *sp) {
+    if (sp->prev_partial) sp->prev_partial->next_partial = sp->next_partial;
+    else g_iobuf_partial[sp->cls] = sp->next_partial;
+    if (sp->next_partial) sp->next_partial->prev_partial = sp->prev_partial;
+    sp->next_partial = sp->prev_partial = NULL;
+}
+
+// descriptors are carved from whole pages and recycled, never unmapped
+static iobuf_span_t* iobuf_desc_get(void) {
+    if (!g_iobuf_desc_free) {
+        size_t ps = os_pagesize();
+        iobuf_span_t *page = (iobuf_span_t*)os_alloc(ps);
+        if (!page) return NULL;
+        g_iobuf_bytes += ps;
+        for (size_t i = 0; i < ps / sizeof(iobuf_span_t); ++i) {
+            page[i].next_partial = g_iobuf_desc_free;
+            g_iobuf_desc_free = &page[i];
+        }
+    }
+    iobuf_span_t *sp = g_iobuf_desc_free;
+    g_iobuf_desc_free = sp->next_partial;
+    memset(sp, 0, sizeof(*sp));
+    return sp;
+}
+
+static void iobuf_desc_put(iobuf_span_t *sp) {
+    sp->next_partial = g_iobuf_desc_free;
+    g_iobuf_desc_free = sp;
+}
+
+// map a span and its descriptor; for IOBUF_LARGE the span is one buffer of buf_size
+static iobuf_span_t* iobuf_span_new(unsigned cls, size_t buf_size) {
+    size_t nbufs = 1;
+    if (cls != IOBUF_LARGE) {
+        nbufs = IOBUF_SPAN_MIN_BYTES / buf_size;
+        if (nbufs < IOBUF_SPAN_MIN_BUFS) nbufs = IOBUF_SPAN_MIN_BUFS;
+    }
+    size_t span = nbufs * buf_size;
+    iobuf_span_t *sp = iobuf_desc_get();
+    if (!sp) return NULL;
+    uint8_t *base = (uint8_t*)os_alloc(span);
+    if (!base) {
+        iobuf_desc_put(sp);
+        return NULL;
+    }
+    sp->base = base;
+    sp->size = span;
+    sp->buf_size = buf_size;
+    sp->cls = cls;
+    sp->nbufs = (unsigned)nbufs;
+    sp->nfree = sp->nbufs;
+    if (iobuf_table_insert(sp) != 0) {
+        os_free(base, span);
+        iobuf_desc_put(sp);
+        return NULL;
+    }
+    g_iobuf_bytes += span;
+    return sp;
+}
+
+static void iobuf_span_release(size_t table_index) {
+    iobuf_span_t *sp = g_iobuf_spans[table_index];
+    iobuf_table_remove(table_index);
+    g_iobuf_bytes -= sp->size;
+    os_free(sp->base, sp->size);
+    iobuf_desc_put(sp);
+}
+
+static void *iobuf_alloc_impl(size_t len);
+static void  iobuf_free_impl(void *buf);
+
+void *j_iobuf_alloc(size_t len) {
+    os_mutex_lock(&g_iobuf_lock);
+    void *p = iobuf_alloc_impl(len);
+    os_mutex_unlock(&g_iobuf_lock);
+    return p;
+}
+
+void j_iobuf_free(void *buf) {
+    if (!buf) return;
+    os_mutex_lock(&g_iobuf_lock);
+    iobuf_free_impl(buf);
+    os_mutex_unlock(&g_iobuf_lock);
+}
+
+static void *iobuf_alloc_impl(size_t len) {
+    if (len == 0) return NULL;
+    size_t want = ALIGN_UP(len, (size_t)IOBUF_ALIGN);
+    unsigned cls = 0;
+    while (cls < IOBUF_NCLASS && k_iobuf_class[cls] < want) cls++;
+
+    // bigger than every class: a dedicated span, still header free
+    if (cls == IOBUF_LARGE) {
+        iobuf_span_t *sp = iobuf_span_new(IOBUF_LARGE, want);
+        if (!sp) return NULL;
+        sp->used = 1;
+        sp->nfree = 0;
+        return sp->base;
+    }
+
+    iobuf_span_t *sp = g_iobuf_partial[cls];
+    if (!sp) {
+        sp = iobuf_span_new(cls, k_iobuf_class[cls]);
+        if (!sp) return NULL;
+        iobuf_partial_push(sp);
+    }
+    // lowest free buffer in the span keeps the live ones packed at the front
+    unsigned i = (unsigned)__builtin_ctzll(~sp->used);
+    sp->used |= 1ull << i;
+    if (--sp->nfree == 0) iobuf_partial_remove(sp);
+    return sp->base + (size_t)i * sp->buf_size;
+}
+
+static void iobuf_free_impl(void *buf) {
+    long ti = iobuf_span_find(buf);
+    if (ti < 0) return;
+    iobuf_span_t *sp = g_iobuf_spans[ti];
+    size_t i = (size_t)((uint8_t*)buf - sp->base) / sp->buf_size;
+    uint64_t bit = 1ull << i;
+    // ignore double frees and pointers into the middle of a buffer
+    if (!(sp->used & bit) || sp->base + i * sp->buf_size != (uint8_t*)buf) return;
+    sp->used &= ~bit;
+
+    if (sp->cls == IOBUF_LARGE) {
+        iobuf_span_release((size_t)ti);
+        return;
+    }
+    if (sp->nfree++ == 0) iobuf_partial_push(sp);
+    // an empty span goes back to the OS unless it is the class's only spare
+    if (sp->nfree == sp->nbufs && (sp->prev_partial || sp->next_partial)) {
+        iobuf_partial_remove(sp);
+        iobuf_span_release((size_t)ti);
+    }
+}
+
+size_t j_iobuf_size(const void *buf) {
+    os_mutex_lock(&g_iobuf_lock);
+    long ti = iobuf_span_find(buf);
+    size_t n = ti < 0 ? 0 : g_iobuf_spans[ti]->buf_size;
+    os_mutex_unlock(&g_iobuf_lock);
+    return n;
+}
+
+size_t j_iobuf_bytes() {
+    return g_iobuf_bytes;
+}
+
+size_t j_free_bytes() {
+    size_t sum = 0;
+    os_mutex_lock(&g_heap_lock);
+    for (heap_t *h = g_heaps; h < g_heaps + J_MAX_SITE_GROUPS; ++h) {
+        for (block_header_t *cur = h->head; cur; cur = cur->next) {
+            if (cur->free) sum += cur->size;
+        }
+    }
+    os_mutex_unlock(&g_heap_lock);
+    return sum;
+}
+
+size_t j_largest_free() {
+    size_t best = 0;
+    os_mutex_lock(&g_heap_lock);
+    for (heap_t *h = g_heaps; h < g_heaps + J_MAX_SITE_GROUPS; ++h) {
+        for (block_header_t *cur = h->head; cur; cur = cur->next) {
+            if (cur->free && cur->size > best) best = cur->size;
+        }
+    }
+    os_mutex_unlock(&g_heap_lock);
+    return best;
+}
+
+void j_arena_stats(j_arena_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+    os_mutex_lock(&g_heap_lock);
+    tc_walk_begin();
+    for (heap_t *h = g_heaps; h < g_heaps + J_MAX_SITE_GROUPS; ++h) {
+        for (arena_header_t *a = h->arenas; a; a = a->next) {
+            // an arena's blocks are contiguous in the list, starting at first_block
+            const uint8_t *end = (const uint8_t*)a + a->size;
+            size_t live = 0;
+            for (block_header_t *b = a->first_block; b && (const uint8_t*)b > (const uint8_t*)a && (const uint8_t*)b < end; b = b->next) {
+                if (!b->free && !(b->flags & (BLK_CACHED | BLK_ZEROING))) live += b->size;
+            }
+            out->arenas++;
+            if (live == 0) out->empty_arenas++;
+            else if (live < a->size / 4) out->sparse_arenas++;
+            out->live_bytes += live;
+            out->mapped_bytes += a->size;
+        }
+    }
+    out->steals = g_steals;
+    out->stolen_bytes = g_stolen_bytes;
+    tc_walk_end();
+    os_mutex_unlock(&g_heap_lock);
+}
+
+// heap map: page rows are emitted as the walk moves past them
+enum { MAP_ALLOC, MAP_FREE, MAP_PURGED, MAP_META, MAP_KINDS };
+
+typedef struct {
+    FILE *f;
+    size_t arena, group, ps;
+    size_t page; // page the counts belong to
+    size_t bytes[MAP_KINDS];
+} heap_map_t;
+
+static void heap_map_flush(heap_map_t *m) {
+    fprintf(m->f, "%zu,%zu,%zu,%zu,%zu,%zu,%zu\n", m->arena, m->group, m->page,
+            m->bytes[MAP_ALLOC], m->bytes[MAP_FREE], m->bytes[MAP_PURGED], m->bytes[MAP_META]);
+    memset(m->bytes, 0, sizeof(m->bytes));
+}
+
+// account arena bytes [off, off + len) to one state
+static void heap_map_add(heap_map_t *m, size_t off, size_t len, int kind) {
+    while (len) {
+        size_t page = off / m->ps;
+        if (page != m->page) {
+            heap_map_flush(m);
+            m->page = page;
+        }
+        size_t take = (page + 1) * m->ps - off;
+        if (take > len) take = len;
+        m->bytes[kind] += take;
+        off += take;
+        len -= take;
+    }
+}
+
+static void heap_map_arena(heap_map_t *m, const arena_header_t *a) {
+    const uint8_t *base = (const uint8_t*)a;
+    m->page = 0;
+    heap_map_add(m, 0, arena_header_size(), MAP_META);
+    size_t off = arena_header_size();
+    for (block_header_t *b = a->first_block; b && (const uint8_t*)b > base && (const uint8_t*)b < base + a->size; b = b->next) {
+        size_t payload = off + header_size();
+        heap_map_add(m, off, header_size(), MAP_META);
+        if (!b->free && !(b->flags & (BLK_CACHED | BLK_ZEROING))) {
+            heap_map_add(m, payload, b->size, MAP_ALLOC);
+        } else if (b->flags & BLK_PURGED) {
+            // the pages purge_free_blocks released: those wholly inside the payload
+            size_t lo = ALIGN_UP(payload, m->ps);
+            size_t hi = (payload + b->size) & ~(m->ps - 1);
+            if (hi <= lo) lo = hi = payload;
+            heap_map_add(m, payload, lo - payload, MAP_FREE);
+            heap_map_add(m, lo, hi - lo, MAP_PURGED);
+            heap_map_add(m, hi, payload + b->size - hi, MAP_FREE);
+        } else {
+            heap_map_add(m, payload, b->size, MAP_FREE);
+        }
+        off = payload + b->size;
+    }
+    // slack too small for a block at the end of the arena
+    heap_map_add(m, off, a->size - off, MAP_META);
+    heap_map_flush(m);
+}
+
+int j_heap_map(const char *path) {
+    if (!path) {
+        errno = EINVAL;
+        return -1;
+    }
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    heap_map_t m;
+    memset(&m, 0, sizeof(m));
+    m.f = f;
+    m.ps = os_pagesize();
+    os_mutex_lock(&g_heap_lock);
+    tc_walk_begin();
+    fprintf(f, "# jmalloc heap map v1 page_size=%zu policy=%s\n", m.ps, g_policy->name);
+    fputs("arena,group,page,alloc,free,purged,meta\n", f);
+    for (heap_t *h = g_heaps; h < g_heaps + J_MAX_SITE_GROUPS; ++h) {
+        // oldest arena first, the order its blocks appear in the list
+        arena_header_t *a = h->arenas;
+        while (a && a->next) a = a->next;
+        for (; a; a = a->prev) {
+            m.group = (size_t)(h - g_heaps);
+            heap_map_arena(&m, a);
+            m.arena++;
+        }
+    }
+    tc_walk_end();
+    os_mutex_unlock(&g_heap_lock);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+int j_site_groups(unsigned groups) {
+    if (groups > J_MAX_SITE_GROUPS) {
+        errno = EINVAL;
+        return -1;
+    }
+    os_mutex_lock(&g_heap_lock);
+    for (unsigned i = 0; i < 256; ++i) g_site_map[i] = groups > 1 ? (unsigned char)(i % groups) : 0;
+    g_site_groups = groups > 1 ? groups : 0;
+    g_site_use = g_site_groups || g_leak_on || g_thread_heaps;
+    tc_update_active();
+    os_mutex_unlock(&g_heap_lock);
+    return 0;
+}
+
+int j_thread_heaps(unsigned heaps) {
+    if (heaps > J_MAX_SITE_GROUPS) {
+        errno = EINVAL;
+        return -1;
+    }
+    os_mutex_lock(&g_heap_lock);
+    g_thread_heaps = heaps > 1 ? heaps : 0;
+    g_site_use = g_site_groups || g_leak_on || g_thread_heaps;
+    tc_update_active();
+    os_mutex_unlock(&g_heap_lock);
+    return 0;
+}
+
+static void leak_report_at_exit(void) {
+    j_leak_report(NULL);
+}
+
+int j_leak_tracking(int enable, int report_at_exit) {
+    static int exit_registered = 0;
+    os_mutex_lock(&g_heap_lock);
+    if (enable && !g_leak_sites) {
+        g_leak_sites = (_Atomic uintptr_t*)os_alloc(LEAK_SITES * sizeof(uintptr_t));
+        if (!g_leak_sites) {
+            os_mutex_unlock(&g_heap_lock);
+            return -1;
+        }
+    }
+    g_leak_on = enable != 0;
+    g_site_use = g_site_groups || g_leak_on || g_thread_heaps;
+    int need_atexit = report_at_exit && !exit_registered;
+    if (need_atexit) exit_registered = 1;
+    os_mutex_unlock(&g_heap_lock);
+    if (need_atexit) atexit(leak_report_at_exit);
+    return 0;
+}
+
+static int site_usage_cmp(const void *a, const void *b) {
+    const j_site_usage_t *x = (const j_site_usage_t*)a, *y = (const j_site_usage_t*)b;
+    if (x->bytes != y->bytes) return x->bytes < y->bytes ? 1 : -1;
+    if (x->blocks != y->blocks) return x->blocks < y->blocks ? 1 : -1;
+    return 0;
+}
+
+// sums the live blocks per site id into an array mapped with os_alloc (one
+// entry per id, the first *n of them used, largest first). NULL if it cannot be mapped
+static j_site_usage_t *leak_collect(size_t *n) {
+    *n = 0;
+    j_site_usage_t *u = (j_site_usage_t*)os_alloc(LEAK_SITES * sizeof(j_site_usage_t));
+    if (!u) return NULL;
+    os_mutex_lock(&g_heap_lock);
+    tc_walk_begin();
+    for (unsigned g = 0; g < J_MAX_SITE_GROUPS; ++g) {
+        for (block_header_t *b = g_heaps[g].head; b; b = b->next) {
+            if (b->free || (b->flags & (BLK_CACHED | BLK_ZEROING))) continue;
+            u[b->site].blocks++;
+            u[b->site].bytes += b->size;
+        }
+    }
+    tc_walk_end();
+    size_t used = 0;
+    for (unsigned id = 0; id < LEAK_SITES; ++id) {
+        if (!u[id].blocks) continue;
+        j_site_usage_t e = u[id];
+        e.site = id && g_leak_sites ? (const void*)atomic_load_explicit(&g_leak_sites[id], memory_order_relaxed) : NULL;
+        u[used++] = e;
+    }
+    os_mutex_unlock(&g_heap_lock);
+    qsort(u, used, sizeof(*u), site_usage_cmp);
+    *n = used;
+    return u;
+}
+
+size_t j_leak_sites(j_site_usage_t *out, size_t max) {
+    size_t n;
+    j_site_usage_t *u = leak_collect(&n);
+    if (!u) return 0;
+    for (size_t i = 0; i < n && i < max; ++i) out[i] = u[i];
+    os_free(u, LEAK_SITES * sizeof(j_site_usage_t));
+    return n;
+}
+
+size_t j_leak_report(const char *path) {
+    FILE *f = path ? fopen(path, "w") : stderr;
+    if (!f) return 0;
+    size_t n, blocks = 0, bytes = 0;
+    j_site_usage_t *u = leak_collect(&n);
+    for (size_t i = 0; i < n; ++i) {
+        blocks += u[i].blocks;
+        bytes += u[i].bytes;
+    }
+    fprintf(f, "jmalloc: %zu live blocks, %zu bytes, %zu sites\n", blocks, bytes, n);
+    for (size_t i = 0; i < n; ++i) {
+        if (u[i].site) fprintf(f, "  %12zu B %8zu blocks  %p\n", u[i].bytes, u[i].blocks, u[i].site);
+        else fprintf(f, "  %12zu B %8zu blocks  (untracked)\n", u[i].bytes, u[i].blocks);
+    }
+    unsigned long long folded = atomic_load_explicit(&g_leak_collisions, memory_order_relaxed);
+    if (folded) fprintf(f, "  (%llu site lookups hit an id owned by another address)\n", folded);
+    if (u) os_free(u, LEAK_SITES * sizeof(j_site_usage_t));
+    if (path) fclose(f);
+    return blocks;
+}
+
+// epoch-based deferred free
+// readers bracket their accesses with j_epoch_enter/exit; j_free_deferred parks
+// a block in the caller's bag for the current epoch. the epoch only advances once
+// every thread inside a critical section has observed it, so two advances later
+// no reader can still hold a block from that bag and it goes to j_free_batch.
+#define DEFER_COLLECT_EVERY 64 // deferred frees between reclamation attempts
+
+void j_epoch_enter() {
+    thread_state_t *ts = thread_state();
+    if (!ts || ts->epoch_nest++ > 0) return;
+    unsigned long long e = atomic_load_explicit(&g_epoch, memory_order_acquire);
+    atomic_store_explicit(&ts->epoch_state, (e << 1) | 1u, memory_order_relaxed);
+    // publish "inside" before any shared pointer is loaded
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void j_epoch_exit() {
+    thread_state_t *ts = t_state;
+    if (!ts || ts->epoch_nest == 0 || --ts->epoch_nest > 0) return;
+    atomic_store_explicit(&ts->epoch_state, 0, memory_order_release);
+}
+
+// advance the global epoch if every active thread has caught up with it;
+// also hands back orphaned chunks whose grace period is over
+static unsigned long long epoch_try_advance(defer_chunk_t **ready) {
+    atomic_thread_fence(memory_order_seq_cst);
+    os_mutex_lock(&g_threads_lock);
+    unsigned long long e = atomic_load_explicit(&g_epoch, memory_order_acquire);
+    int behind = 0;
+    for (thread_state_t *ts = g_threads; ts; ts = ts->next) {
+        unsigned long long st = atomic_load_explicit(&ts->epoch_state, memory_order_acquire);
+        if ((st & 1u) && (st >> 1) != e) {
+            behind = 1;
+            break;
+        }
+    }
+    if (!behind) {
+        atomic_store_explicit(&g_epoch, e + 1, memory_order_release);
+        e++;
+    }
+    defer_chunk_t **link = &g_orphan_chunks;
+    while (*link) {
+        defer_chunk_t *c = *link;
+        if (c->epoch + 2 <= e) {
+            *link = c->next;
+            c->next = *ready;
+            *ready = c;
+        } else {
+            link = &c->next;
+        }
+    }
+    os_mutex_unlock(&g_threads_lock);
+    return e;
+}
+
+// free every chunk on the list through the bulk path and recycle one chunk
+static void defer_release_chunks(thread_state_t *ts, defer_chunk_t *c) {
+    while (c) {
+        defer_chunk_t *next = c->next;
+        j_free_batch(c->ptrs, c->count);
+        c->count = 0;
+        if (ts && !ts->spare_chunk) {
+            ts->spare_chunk = c;
+        } else {
+            os_free(c, sizeof(defer_chunk_t));
+        }
+        c = next;
+    }
+}
+
+static void epoch_collect(thread_state_t *ts) {
+    defer_chunk_t *orphans = NULL;
+    unsigned long long e = epoch_try_advance(&orphans);
+    defer_release_chunks(ts, orphans);
+    for (int b = 0; b < 3; ++b) {
+        defer_bag_t *bag = &ts->bags[b];
+        if (bag->chunks && bag->epoch + 2 <= e) {
+            defer_chunk_t *c = bag->chunks;
+            bag->chunks = NULL;
+            defer_release_chunks(ts, c);
+        }
+    }
+}
+
+void j_free_deferred(void *ptr) {
+    if (!ptr) return;
+    thread_state_t *ts = thread_state();
+    // without a thread record there is nowhere to park the block; keeping it
+    // alive is the only safe choice
+    if (!ts) return;
+    unsigned long long e = atomic_load_explicit(&g_epoch, memory_order_acquire);
+    defer_bag_t *bag = &ts->bags[e % 3];
+    if (bag->chunks && bag->epoch != e) {
+        // this slot still holds epoch e - 3 (or older): long past its grace period
+        defer_chunk_t *old = bag->chunks;
+        bag->chunks = NULL;
+        defer_release_chunks(ts, old);
+    }
+    bag->epoch = e;
+
+    defer_chunk_t *c = bag->chunks;
+    if (!c || c->count == DEFER_CHUNK_PTRS) {
+        defer_chunk_t *n = ts->spare_chunk;
+        if (n) ts->spare_chunk = NULL;
+        else n = (defer_chunk_t*)os_alloc(sizeof(defer_chunk_t));
+        if (!n) return; // out of memory: leak rather than free too early
+        n->count = 0;
+        n->next = c;
+        bag->chunks = c = n;
+    }
+    c->ptrs[c->count++] = ptr;
+
+    if (++ts->defer_since_collect >= DEFER_COLLECT_EVERY) {
+        ts->defer_since_collect = 0;
+        epoch_collect(ts);
+    }
+}
+
+void j_epoch_reclaim() {
+    thread_state_t *ts = thread_state();
+    if (!ts) return;
+    // two advances cover the grace period of everything retired so far,
+    // as long as no other thread is stuck inside a critical section
+    for (int i = 0; i < 3; ++i) epoch_collect(ts);
+}
+
+// asynchronous free
+// j_free_async pushes onto the caller's queue; a background thread wakes every
+// BG_TICK_MS (or sooner when a queue grows long), collects every queue, sorts
+// the blocks by address so each arena is visited once, and bulk frees them
+#define BG_TICK_MS 5
+#define ASYNC_WAKE_EVERY 4096 // pushes between explicit wake-ups
+#define ASYNC_BATCH 1024      // blocks per j_free_batch call
+
+static os_mutex_t g_bg_lock = OS_MUTEX_INIT;
+static os_cond_t g_bg_cond = OS_COND_INIT;
+static _Atomic int g_bg_started = 0; // set under g_bg_lock, read without it
+static os_mutex_t g_async_drain_lock = OS_MUTEX_INIT; // one drain at a time, owns the scratch array
+static void **g_async_scratch = NULL;
+static size_t g_async_scratch_cap = 0;
+
+static int cmp_ptr(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(void* const*)a, y = (uintptr_t)*(void* const*)b;
+    return x < y ? -1 : x > y;
+}
+
+// collect every queued block and free them in address order; returns the count
+static size_t async_drain(void) {
+    os_mutex_lock(&g_async_drain_lock);
+    void *all = NULL;
+    os_mutex_lock(&g_threads_lock);
+    for (thread_state_t *ts = g_threads; ts; ts = ts->next) {
+        void *q = atomic_exchange_explicit(&ts->async_head, NULL, memory_order_acquire);
+        while (q) {
+            void *next = *(void**)q;
+            *(void**)q = all;
+            all = q;
+            q = next;
+        }
+    }
+    while (g_async_orphans) {
+        void *next = *(void**)g_async_orphans;
+        *(void**)g_async_orphans = all;
+        all = g_async_orphans;
+        g_async_orphans = next;
+    }
+    os_mutex_unlock(&g_threads_lock);
+
+    size_t n = 0;
+    for (void *q = all; q; q = *(void**)q) n++;
+    if (n == 0) {
+        os_mutex_unlock(&g_async_drain_lock);
+        return 0;
+    }
+    if (n > g_async_scratch_cap) {
+        size_t cap = g_async_scratch_cap ? g_async_scratch_cap : 4096;
+        while (cap < n) cap *= 2;
+        void **t = (void**)os_alloc(cap * sizeof(void*));
+        if (t) {
+            if (g_async_scratch) os_free(g_async_scratch, g_async_scratch_cap * sizeof(void*));
+            g_async_scratch = t;
+            g_async_scratch_cap = cap;
+        }
+    }
+    if (n > g_async_scratch_cap) {
+        // no room to sort: free in queue order rather than hold on to the memory
+        while (all) {
+            void *next = *(void**)all;
+            j_free(all);
+            all = next;
+        }
+    } else {
+        size_t i = 0;
+        for (void *q = all; q; q = *(void**)q) g_async_scratch[i++] = q;
+        qsort(g_async_scratch, n, sizeof(void*), cmp_ptr);
+        for (i = 0; i < n; i += ASYNC_BATCH) {
+            j_free_batch(g_async_scratch + i, n - i < ASYNC_BATCH ? n - i : ASYNC_BATCH);
+        }
+    }
+    os_mutex_unlock(&g_async_drain_lock);
+    return n;
+}
+
+// background pre-zeroing
+// with a target set, every PREZERO_EVERY ticks the background thread tops the
+// known-zero free bytes back up: it checks dirty free blocks out of the heap
+// (marked in use, so nothing allocates or merges them meanwhile), zeroes them
+// without the lock, and frees them back flagged BLK_ZERO. big spans are purged
+// instead where the OS refills purged pages with zeros, so they also stop
+// costing resident memory; only their unaligned edges are written.
+#define PREZERO_EVERY 10                // ticks between passes
+#define PREZERO_MIN_BLOCK 256           // smaller blocks are left alone
+#define PREZERO_PASS_BLOCKS 64
+#define PREZERO_PASS_BYTES (4u << 20)   // zeroing work per pass
+#define PREZERO_PURGE_BYTES (256u << 10)
+
+static _Atomic size_t g_prezero_target = 0; // polled by the background thread
+static void bg_start(void);
+
+static void prezero_pass(void) {
+    block_header_t *picked[PREZERO_PASS_BLOCKS];
+    unsigned short flags[PREZERO_PASS_BLOCKS];
+    size_t n = 0, bytes = 0;
+    os_mutex_lock(&g_heap_lock);
+    size_t target = atomic_load_explicit(&g_prezero_target, memory_order_relaxed);
+    size_t want = target > g_zero_free_bytes ? target - g_zero_free_bytes : 0;
+    if (want > PREZERO_PASS_BYTES) want = PREZERO_PASS_BYTES;
+    for (heap_t *h = g_heaps; h < g_heaps + J_MAX_SITE_GROUPS && bytes < want; ++h) {
+        for (block_header_t *cur = h->head; cur && bytes < want && n < PREZERO_PASS_BLOCKS; cur = cur->next) {
+            if (!cur->free || (cur->flags & BLK_ZERO) || cur->size < PREZERO_MIN_BLOCK) continue;
+            free_index_remove(h, cur);
+            // BLK_ZEROING keeps the heap walks from taking it for a live block
+            cur->free = 0;
+            cur->flags |= BLK_ZEROING;
+            g_free_bytes -= cur->size;
+            picked[n++] = cur;
+            bytes += cur->size;
+        }
+    }
+    os_mutex_unlock(&g_heap_lock);
+    if (n == 0) return;
+
+    // big spans go out in one purge batch, the rest is written
+    size_t ps = os_pagesize();
+    purge_batch_t batch;
+    batch.n = 0;
+    unsigned char purging[PREZERO_PASS_BLOCKS];
+    for (size_t i = 0; i < n; ++i) {
+        uint8_t *lo;
+        size_t len = payload_pages(picked[i], ps, &lo);
+        // an already purged block is purged again rather than faulted back in by a memset
+        purging[i] = OS_PURGE_ZEROES && len && (picked[i]->size >= PREZERO_PURGE_BYTES || (picked[i]->flags & BLK_PURGED));
+        flags[i] = BLK_ZERO;
+        if (purging[i]) {
+            batch.r[batch.n].p = lo;
+            batch.r[batch.n].n = len;
+            batch.n++;
+        }
+    }
+    int purged = purge_batch_flush(&batch) == 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint8_t *payload = (uint8_t*)picked[i] + header_size(), *lo;
+        size_t size = picked[i]->size, len = payload_pages(picked[i], ps, &lo);
+        if (purging[i] && purged) {
+            memset(payload, 0, (size_t)(lo - payload));
+            memset(lo + len, 0, (size_t)(payload + size - (lo + len)));
+            flags[i] |= BLK_PURGED;
+            atomic_fetch_add_explicit(&g_zs_bg_purged, len, memory_order_relaxed);
+            atomic_fetch_add_explicit(&g_zs_bg_zeroed, size - len, memory_order_relaxed);
+            continue;
+        }
+        memset(payload, 0, size);
+        atomic_fetch_add_explicit(&g_zs_bg_zeroed, size, memory_order_relaxed);
+    }
+
+    os_mutex_lock(&g_heap_lock);
+    for (size_t i = 0; i < n; ++i) {
+        picked[i]->free = 1;
+        picked[i]->flags = flags[i];
+        g_free_bytes += picked[i]->size;
+        coalesce(picked[i]);
+    }
+    os_mutex_unlock(&g_heap_lock);
+}
+
+int j_prezero(size_t target_bytes) {
+    atomic_store_explicit(&g_prezero_target, target_bytes, memory_order_relaxed);
+    if (target_bytes && !atomic_load_explicit(&g_bg_started, memory_order_acquire)) bg_start();
+    if (target_bytes && !atomic_load_explicit(&g_bg_started, memory_order_acquire)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+void j_zero_stats(j_zero_stats_t *out) {
+    out->calloc_calls = atomic_load_explicit(&g_zs_calloc, memory_order_relaxed);
+    out->bytes_known_zero = atomic_load_explicit(&g_zs_known_zero, memory_order_relaxed);
+    out->bytes_memset = atomic_load_explicit(&g_zs_memset, memory_order_relaxed);
+    out->bg_bytes_zeroed = atomic_load_explicit(&g_zs_bg_zeroed, memory_order_relaxed);
+    out->bg_bytes_purged = atomic_load_explicit(&g_zs_bg_purged, memory_order_relaxed);
+    os_mutex_lock(&g_heap_lock);
+    out->zero_free_bytes = g_zero_free_bytes;
+    os_mutex_unlock(&g_heap_lock);
+}
+
+// flight recorder dump
+// the crash handler formats the ring itself into a stack buffer and writes it
+// with plain write(2): no stdio, no locks, no allocation. the dump goes to a
+// path fixed when the handler is installed (default jmalloc-flight.<pid>.log in
+// the working directory, where a core file usually lands too)
+#define FR_PATH_MAX 256
+static char g_fr_path[FR_PATH_MAX];
+static int g_fr_installed = 0;
+static unsigned long long g_fr_snapshot_ms = 0; // 0 = no periodic snapshots
+static unsigned long long g_fr_last_snapshot = 0;
+static volatile sig_atomic_t g_fr_dumping = 0;
+
+typedef struct fr_out {
+    int fd;
+    size_t n;
+    char buf[512];
+} fr_out_t;
+
+static void fr_flush(fr_out_t *o) {
+    if (o->n) os_dump_write(o->fd, o->buf, o->n);
+    o->n = 0;
+}
+static void fr_puts(fr_out_t *o, const char *str) {
+    for (; *str; ++str) {
+        if (o->n == sizeof(o->buf)) fr_flush(o);
+        o->buf[o->n++] = *str;
+    }
+}
+static void fr_putu(fr_out_t *o, unsigned long long v, unsigned base) {
+    char tmp[24];
+    int i = (int)sizeof(tmp) - 1;
+    tmp[i] = 0;
+    do {
+        tmp[--i] = "0123456789abcdef"[v % base];
+        v /= base;
+    } while (v);
+    if (base == 16) fr_puts(o, "0x");
+    fr_puts(o, tmp + i);
+}
+
+// the oldest surviving event first; slots being rewritten are skipped
+static size_t fr_dump_fd(int fd, int sig) {
+    fr_out_t o;
+    o.fd = fd;
+    o.n = 0;
+    unsigned long long now = os_now_ms(), next = atomic_load_explicit(&g_fr_next, memory_order_acquire);
+    unsigned long long first = next > FR_EVENTS ? next - FR_EVENTS : 0;
+    size_t written = 0;
+    fr_puts(&o, "jmalloc flight recorder: pid=");
+    fr_putu(&o, (unsigned long long)os_getpid(), 10);
+    if (sig) {
+        fr_puts(&o, " signal=");
+        fr_putu(&o, (unsigned long long)sig, 10);
+    }
+    fr_puts(&o, " events=");
+    fr_putu(&o, next, 10);
+    fr_puts(&o, " shown=");
+    fr_putu(&o, next - first, 10);
+    // read without the lock: the crashing thread may hold it
+    fr_puts(&o, "\nheap=");
+    fr_putu(&o, g_total_bytes, 10);
+    fr_puts(&o, " free=");
+    fr_putu(&o, g_free_bytes, 10);
+    fr_puts(&o, "\n");
+    for (unsigned long long i = first; i < next; ++i) {
+        const fr_event_t *e = &g_fr_ring[i % FR_EVENTS];
+        if (atomic_load_explicit(&e->seq, memory_order_acquire) != i + 1 || e->kind >= FR_KINDS) continue;
+        fr_puts(&o, "-");
+        fr_putu(&o, now >= e->ms ? now - e->ms : 0, 10);
+        fr_puts(&o, "ms t");
+        fr_putu(&o, e->thread, 10);
+        fr_puts(&o, " ");
+        fr_puts(&o, k_fr_names[e->kind]);
+        int addr = e->kind == FR_ARENA_MAP || e->kind == FR_ARENA_UNMAP || e->kind == FR_LARGE;
+        fr_puts(&o, " ");
+        fr_puts(&o, k_fr_fields[e->kind][0]);
+        fr_puts(&o, "=");
+        fr_putu(&o, e->a, addr ? 16 : 10);
+        fr_puts(&o, " ");
+        fr_puts(&o, k_fr_fields[e->kind][1]);
+        fr_puts(&o, "=");
+        fr_putu(&o, e->b, 10);
+        fr_puts(&o, "\n");
+        written++;
+    }
+    fr_flush(&o);
+    return written;
+}
+
+static void fr_on_crash(int sig) {
+    int saved = errno;
+    if (!g_fr_dumping) {
+        g_fr_dumping = 1;
+        int fd = os_dump_open(g_fr_path);
+        if (fd >= 0) {
+            fr_dump_fd(fd, sig);
+            os_dump_close(fd);
+        }
+    }
+    errno = saved;
+    os_crash_reraise(sig);
+}
+
+static void fr_snapshot(void) {
+    os_mutex_lock(&g_heap_lock);
+    size_t heap = g_total_bytes, free_bytes = g_free_bytes;
+    os_mutex_unlock(&g_heap_lock);
+    fr_record(FR_SNAPSHOT, heap, free_bytes);
+    g_fr_last_snapshot = os_now_ms();
+}
+
+int j_flight_recorder(const char *path, unsigned snapshot_secs) {
+    if (path && strlen(path) >= FR_PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    os_mutex_lock(&g_bg_lock);
+    if (path) {
+        memcpy(g_fr_path, path, strlen(path) + 1);
+    } else {
+        snprintf(g_fr_path, sizeof(g_fr_path), "jmalloc-flight.%d.log", os_getpid());
+    }
+    int install = !g_fr_installed;
+    g_fr_installed = 1;
+    g_fr_snapshot_ms = (unsigned long long)snapshot_secs * 1000u;
+    os_mutex_unlock(&g_bg_lock);
+    if (install) os_crash_handlers_install(fr_on_crash);
+    if (snapshot_secs) {
+        fr_snapshot();
+        if (!atomic_load_explicit(&g_bg_started, memory_order_acquire)) bg_start();
+        if (!atomic_load_explicit(&g_bg_started, memory_order_acquire)) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+size_t j_flight_dump(int fd) {
+    return fr_dump_fd(fd, 0);
+}
+
+static void bg_thread_main(void) {
+    j_thread_name("jmalloc-bg");
+    for (unsigned tick = 1;; ++tick) {
+        os_mutex_lock(&g_bg_lock);
+        os_cond_wait_ms(&g_bg_cond, &g_bg_lock, BG_TICK_MS);
+        os_mutex_unlock(&g_bg_lock);
+        async_drain();
+        if (atomic_load_explicit(&g_prezero_target, memory_order_relaxed) && tick % PREZERO_EVERY == 0) prezero_pass();
+        if (g_fr_snapshot_ms && os_now_ms() - g_fr_last_snapshot >= g_fr_snapshot_ms) fr_snapshot();
+    }
+}
+
+static void bg_start(void) {
+    os_mutex_lock(&g_bg_lock);
+    if (!atomic_load_explicit(&g_bg_started, memory_order_relaxed) && os_thread_start(bg_thread_main) == 0)
+        atomic_store_explicit(&g_bg_started, 1, memory_order_release);
+    os_mutex_unlock(&g_bg_lock);
+}
+
+// push a pre-linked chain [first .. last] onto the caller's queue
+static int async_push(void *first, void *last, size_t n) {
+    thread_state_t *ts = thread_state();
+    if (!ts) return -1;
+    if (J_UNLIKELY(!atomic_load_explicit(&g_bg_started, memory_order_acquire))) bg_start();
+    void *head = atomic_load_explicit(&ts->async_head, memory_order_relaxed);
+    do {
+        *(void**)last = head;
+    } while (!atomic_compare_exchange_weak_explicit(&ts->async_head, &head, first,
+                                                    memory_order_release, memory_order_relaxed));
+    ts->async_since_wake += (unsigned)n;
+    if (ts->async_since_wake >= ASYNC_WAKE_EVERY) {
+        ts->async_since_wake = 0;
+        os_cond_signal(&g_bg_cond);
+    }
+    return 0;
+}
+
+void j_free_async(void *ptr) {
+    if (!ptr) return;
+    // every payload is at least ALIGNMENT bytes, enough for the queue link
+    if (async_push(ptr, ptr, 1) != 0) j_free(ptr);
+}
+
+void j_free_async_batch(void **ptrs, size_t n) {
+    void *first = NULL, *last = NULL;
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (!ptrs[i]) continue;
+        if (last) *(void**)last = ptrs[i];
+        else first = ptrs[i];
+        last = ptrs[i];
+        count++;
+    }
+    if (!first) return;
+    if (async_push(first, last, count) != 0) {
+        for (size_t i = 0; i < n; ++i) j_free(ptrs[i]);
+    }
+}
+
+size_t j_free_async_flush() {
+    return async_drain();
+}
+
+// helpers implementation
+// free-block index: every block that becomes free goes to the active policy
+// and, when it is known to be zero, to its heap's zero list
+static inline zero_link_t* zero_link(block_header_t *blk) {
+    return (zero_link_t*)((uint8_t*)blk + header_size());
+}
+
+static inline int zero_listed(const block_header_t *blk) {
+    return (blk->flags & BLK_ZERO) && blk->size >= sizeof(zero_link_t);
+}
+
+static void free_index_insert(heap_t *h, block_header_t *blk) {
+    g_policy->insert_free(h, blk);
+    if (!(blk->flags & BLK_ZERO)) return;
+    g_zero_free_bytes += blk->size;
+    if (!zero_listed(blk)) return;
+    zero_link_t *l = zero_link(blk);
+    l->prev = NULL;
+    l->next = h->zero_head;
+    if (h->zero_head) zero_link(h->zero_head)->prev = blk;
+    h->zero_head = blk;
+}
+
+static void free_index_remove(heap_t *h, block_header_t *blk) {
+    g_policy->remove_free(h, blk);
+    if (!(blk->flags & BLK_ZERO)) return;
+    g_zero_free_bytes -= blk->size;
+    if (!zero_listed(blk)) return;
+    zero_link_t *l = zero_link(blk);
+    if (l->prev) zero_link(l->prev)->next = l->next;
+    else h->zero_head = l->next;
+    if (l->next) zero_link(l->next)->prev = l->prev;
+    memset(l, 0, sizeof(*l));
+}
+
+// first known-zero block that fits, looking at a bounded number of candidates
+#define ZERO_FIND_MAX 32
+static block_header_t* zero_find(heap_t *h, size_t size) {
+    int seen = 0;
+    for (block_header_t *cur = h->zero_head; cur && seen < ZERO_FIND_MAX; cur = zero_link(cur)->next, ++seen) {
+        if (cur->size >= size) return cur;
+    }
+    return NULL;
+}
+
+// placement policies
+// the list-scanning policies need no index of their own, so their insert/remove
+// hooks are no-ops (next-fit only keeps its rover off blocks leaving the list)
+static void policy_nop_block(heap_t *h, block_header_t *blk) { (void)h; (void)blk; }
+static void policy_nop_reset(heap_t *h) { (void)h; }
+
+static block_header_t* find_first_fit(heap_t *h, size_t size) {
+    // find first fit block in the heap's list
+    for (block_header_t *cur = h->head; cur; cur = cur->next) {
+        // if there is a free block (free = 1) and if its size is larger than or equal to the required size, return the pointer
+        if (cur->free && cur->size >= size) return cur;
+    }
+    // if no fit -> NULL
+    return NULL;
+}
+
+// next-fit: first fit starting from where the previous search ended, wrapping once
+static block_header_t* find_next_fit(heap_t *h, size_t size) {
+    block_header_t *start = h->rover ? h->rover : h->head;
+    for (block_header_t *cur = start; cur; cur = cur->next) {
+        if (cur->free && cur->size >= size) return h->rover = cur;
+    }
+    for (block_header_t *cur = h->head; cur != start; cur = cur->next) {
+        if (cur->free && cur->size >= size) return h->rover = cur;
+    }
+    return NULL;
+}
+
+static void next_fit_remove(heap_t *h, block_header_t *blk) {
+    // the block may be about to leave the list, step past it
+    if (h->rover == blk) h->rover = blk->next;
+}
+
+static void next_fit_reset(heap_t *h) { h->rover = NULL; }
+
+// best-fit: smallest fitting block, stopping early on an exact fit
+static block_header_t* find_best_fit(heap_t *h, size_t size) {
+    block_header_t *best = NULL;
+    for (block_header_t *cur = h->head; cur; cur = cur->next) {
+        if (!cur->free || cur->size < size) continue;
+        if (!best || cur->size < best->size) {
+            best = cur;
+            if (cur->size == size) break;
+        }
+    }
+    return best;
+}
+
+// address-ordered first fit: lowest-address fitting block.
+// the block list is only address ordered within an arena, so free blocks are
+// indexed by a treap keyed by address where every node also carries the largest
+// block size in its subtree; the search descends left whenever the left subtree
+// can satisfy the request, which makes it O(log n) expected.
+// nodes are carved from whole pages and recycled, never unmapped.
+typedef struct addr_node {
+    struct addr_node *left, *right;
+    block_header_t *blk;
+    size_t max_size;   // largest blk->size in this subtree
+    uint32_t prio;
+} addr_node_t;
+
+static addr_node_t *g_addr_node_free = NULL; // spare nodes, linked by left
+static uint32_t g_addr_seed = 2463534242u;
+
+static addr_node_t* addr_node_get(void) {
+    if (!g_addr_node_free) {
+        size_t ps = os_pagesize();
+        addr_node_t *page = (addr_node_t*)os_alloc(ps);
+        if (!page) return NULL;
+        for (size_t i = 0; i < ps / sizeof(addr_node_t); ++i) {
+            page[i].left = g_addr_node_free;
+            g_addr_node_free = &page[i];
+        }
+    }
+    addr_node_t *n = g_addr_node_free;
+    g_addr_node_free = n->left;
+    return n;
+}
+
+static void addr_node_put(addr_node_t *n) {
+    n->left = g_addr_node_free;
+    g_addr_node_free = n;
+}
+
+static inline size_t addr_max(const addr_node_t *n) { return n ? n->max_size : 0; }
+
+static inline void addr_update(addr_node_t *n) {
+    size_t m = n->blk->size;
+    if (addr_max(n->left) > m) m = addr_max(n->left);
+    if (addr_max(n->right) > m) m = addr_max(n->right);
+    n->max_size = m;
+}
+
+// split t into blocks below key and blocks at or above it
+static void addr_split(addr_node_t *t, const block_header_t *key, addr_node_t **lo, addr_node_t **hi) {
+    if (!t) {
+        *lo = *hi = NULL;
+        return;
+    }
+    if (t->blk < key) {
+        addr_split(t->right, key, &t->right, hi);
+        *lo = t;
+    } else {
+        addr_split(t->left, key, lo, &t->left);
+        *hi = t;
+    }
+    addr_update(t);
+}
+
+// every key in a is below every key in b
+static addr_node_t* addr_merge(addr_node_t *a, addr_node_t *b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->prio > b->prio) {
+        a->right = addr_merge(a->right, b);
+        addr_update(a);
+        return a;
+    }
+    b->left = addr_merge(a, b->left);
+    addr_update(b);
+    return b;
+}
+
+static addr_node_t* addr_insert(addr_node_t *t, addr_node_t *n) {
+    if (!t) return n;
+    if (n->prio > t->prio) {
+        addr_split(t, n->blk, &n->left, &n->right);
+        addr_update(n);
+        return n;
+    }
+    if (n->blk < t->blk) t->left = addr_insert(t->left, n);
+    else t->right = addr_insert(t->right, n);
+    addr_update(t);
+    return t;
+}
+
+static addr_node_t* addr_erase(addr_node_t *t, const block_header_t *blk) {
+    if (!t) return NULL;
+    if (t->blk == blk) {
+        addr_node_t *rest = addr_merge(t->left, t->right);
+        addr_node_put(t);
+        return rest;
+    }
+    if (blk < t->blk) t->left = addr_erase(t->left, blk);
+    else t->right = addr_erase(t->right, blk);
+    addr_update(t);
+    return t;
+}
+
+static void addr_insert_free(heap_t *h, block_header_t *blk) {
+    addr_node_t *n = addr_node_get();
+    // without a node the block just stays invisible to placement until it is freed again
+    if (!n) return;
+    // xorshift32 for treap priorities
+    g_addr_seed ^= g_addr_seed << 13;
+    g_addr_seed ^= g_addr_seed >> 17;
+    g_addr_seed ^= g_addr_seed << 5;
+    n->left = n->right = NULL;
+    n->blk = blk;
+    n->max_size = blk->size;
+    n->prio = g_addr_seed;
+    h->addr_root = addr_insert(h->addr_root, n);
+}
+
+static void addr_remove_free(heap_t *h, block_header_t *blk) {
+    h->addr_root = addr_erase(h->addr_root, blk);
+}
+
+static void addr_release(addr_node_t *t) {
+    if (!t) return;
+    addr_release(t->left);
+    addr_release(t->right);
+    addr_node_put(t);
+}
+
+static void addr_reset(heap_t *h) {
+    addr_release(h->addr_root);
+    h->addr_root = NULL;
+}
+
+static block_header_t* find_address_fit(heap_t *h, size_t size) {
+    addr_node_t *t = h->addr_root;
+    if (addr_max(t) < size) return NULL;
+    for (;;) {
+        if (addr_max(t->left) >= size) t = t->left;
+        else if (t->blk->size >= size) return t->blk;
+        else t = t->right; // the subtree max guarantees a fit on this side
+    }
+}
+
+static const placement_policy_t k_policies[J_POLICY_COUNT] = {
+    [J_POLICY_FIRST_FIT]       = { "first",   find_first_fit,   policy_nop_block, policy_nop_block, policy_nop_reset },
+    [J_POLICY_NEXT_FIT]        = { "next",    find_next_fit,    policy_nop_block, next_fit_remove,  next_fit_reset },
+    [J_POLICY_BEST_FIT]        = { "best",    find_best_fit,    policy_nop_block, policy_nop_block, policy_nop_reset },
+    [J_POLICY_ADDRESS_ORDERED] = { "address", find_address_fit, addr_insert_free, addr_remove_free, addr_reset },
+};
+
+// make p the active policy and hand it every free block
+static void policy_activate(const placement_policy_t *p) {
+    for (heap_t *h = g_heaps; h < g_heaps + J_MAX_SITE_GROUPS; ++h) {
+        for (block_header_t *cur = h->head; cur; cur = cur->next) {
+            if (cur->free) g_policy->remove_free(h, cur);
+        }
+    }
+    g_policy = p;
+    for (heap_t *h = g_heaps; h < g_heaps + J_MAX_SITE_GROUPS; ++h) {
+        g_policy->reset(h);
+        for (block_header_t *cur = h->head; cur; cur = cur->next) {
+            if (cur->free) g_policy->insert_free(h, cur);
+        }
+    }
+    g_policy_chosen = 1;
+}
+
+// JMALLOC_POLICY is consulted once, when the heap first grows
+static void policy_init_from_env(void) {
+    g_policy_chosen = 1;
+    const char *name = getenv("JMALLOC_POLICY");
+    if (!name) return;
+    for (int i = 0; i < J_POLICY_COUNT; ++i) {
+        if (strcmp(name, k_policies[i].name) == 0) {
+            policy_activate(&k_policies[i]);
+            return;
+        }
+    }
+}
+
+static block_header_t* request_space(heap_t *h, size_t size) {
+    // allocate at least ARENA_MIN_SIZE to reduce OS calls
+    size_t need = header_size() + size;
+    // if need is larger than ARENA_MIN_SIZE, allocate need; otherwise allocate ARENA_MIN_SIZE (+ arena header size)
+    size_t arena_total = arena_header_size() + (need > ARENA_MIN_SIZE ? need : ARENA_MIN_SIZE);
+
+    // budget enforcement happens here, when the heap grows
+    if (J_UNLIKELY(g_budget_active) && !budget_admit(arena_total)) return NULL;
+    // so does the pressure check, at most once per poll interval
+    if (J_UNLIKELY(g_pressure_enabled)) {
+        unsigned interval = g_pressure_cfg.poll_interval_ms ? g_pressure_cfg.poll_interval_ms : 100;
+        if (os_now_ms() - g_pressure_last_ms >= interval) pressure_poll_impl();
+    }
+
+    if (J_UNLIKELY(!g_policy_chosen)) policy_init_from_env();
+    if (J_UNLIKELY(!g_sc_env_read)) sizeclass_init_from_env();
+
+    // ask OS for memory
+    void* mem = os_alloc(arena_total);
+    if (!mem) return NULL;
+    fr_record(FR_ARENA_MAP, (uintptr_t)mem, arena_total);
+
+    // set up arena header
+    // [mem start] -> [arena_header][block_header_t first block][...]
+    arena_header_t* a = (arena_header_t*)mem;
+    a->size = arena_total;
+    a->prev = NULL;
+    // first arena in the heap's arena list assigned to a->next
+    // then, the first arena in h->arenas will get a as prev arena
+    // then, set h->arenas to a (now first)
+    a->next = h->arenas;
+    if (h->arenas) h->arenas->prev = a;
+    h->arenas = a;
+    a->buf_index = -1;
+    if (J_UNLIKELY(g_uring_fd >= 0)) uring_register_arena(a);
+
+    // first block placed right after arena header; if we reserved a big arena, split to leave a trailing free block
+    uint8_t* base = (uint8_t*)mem + arena_header_size();
+    block_header_t* blk = (block_header_t*)base;
+    blk->prev = h->tail;
+    blk->next = NULL;
     blk->free = 0;
+    blk->group = (unsigned char)(h - g_heaps);
+    blk->flags = BLK_ZERO; // fresh pages are zero-filled
     blk->size = size;
 
-    if (!g_head) g_head = blk;
-    if (g_tail) g_tail->next = blk;
-    g_tail = blk;
+    if (!h->head) h->head = blk;
+    if (h->tail) h->tail->next = blk;
+    h->tail = blk;
 
     a->first_block = blk;
 
@@ -253,13 +3789,16 @@ static block_header_t* request_space(size_t size) {
         block_header_t* f = (block_header_t*)faddr;
         f->size = (arena_total - used) - header_size();
         f->free = 1;
+        f->group = blk->group;
+        f->flags = BLK_ZERO;
         f->prev = blk;
         f->next = blk->next;
         // if there is a next block, update its prev pointer
         if (f->next) f->next->prev = f;
-        else g_tail = f;
+        else h->tail = f;
         blk->next = f;
         g_free_bytes += f->size;
+        free_index_insert(h, f);
     }
 
     return blk;
@@ -278,41 +3817,77 @@ static void split_block(block_header_t *blk, size_t req_size) {
     // payload size = remaining - header size
     n->size = remain - header_size();
     n->free = 1;
+    n->group = blk->group;
+    // the remainder keeps whatever page state the original block had
+    n->flags = blk->flags & BLK_STATE_MASK;
     n->prev = blk;
     n->next = blk->next;
     // update next block's prev pointer if exists
-    if (n->next) n->next->prev = n; 
-    else g_tail = n;
+    if (n->next) n->next->prev = n;
+    else heap_of(blk)->tail = n;
     blk->next = n;
 
     g_free_bytes += n->size;
+    // shrinking in place can leave the remainder right before a free block,
+    // merge them so a fully free arena is still one block
+    block_header_t *after = n->next;
+    if (after && after->free && blocks_adjacent(n, after)) {
+        free_index_remove(heap_of(blk), after);
+        n->size += header_size() + after->size;
+        n->flags &= after->flags;
+        n->next = after->next;
+        if (n->next) n->next->prev = n;
+        else heap_of(blk)->tail = n;
+        g_free_bytes += header_size();
+        // the absorbed header is payload now
+        if (n->flags & BLK_ZERO) memset(after, 0, header_size());
+    }
+    free_index_insert(heap_of(blk), n);
+}
+
+// a heap's list runs across its arenas, so list neighbours are only mergeable
+// when they are also neighbours in memory
+static int blocks_adjacent(const block_header_t *a, const block_header_t *b) {
+    return (const uint8_t*)a + header_size() + a->size == (const uint8_t*)b;
 }
 
+// blk was just freed and is not known to the policy yet; neighbours it absorbs
+// are taken back from the policy and the merged block is handed to it
 static block_header_t* coalesce(block_header_t *blk) {
+    heap_t *h = heap_of(blk);
     // merge with next if free
     // if there is a next block and if it is free
-    if (blk->next && blk->next->free) {
+    if (blk->next && blk->next->free && blocks_adjacent(blk, blk->next)) {
         block_header_t *n = blk->next;
+        free_index_remove(h, n);
         // merge sizes
         blk->size += header_size() + n->size;
+        blk->flags &= n->flags;
         // update links
         blk->next = n->next;
         // if there is a next block, update its prev pointer
         if (blk->next) blk->next->prev = blk; 
-        else g_tail = blk;
+        else h->tail = blk;
 
         g_free_bytes += header_size();
+        if (blk->flags & BLK_ZERO) memset(n, 0, header_size());
     }
     // merge with prev if free
     // merge to the previous block, return the previous block pointer
-    if (blk->prev && blk->prev->free) {
+    if (blk->prev && blk->prev->free && blocks_adjacent(blk->prev, blk)) {
         block_header_t *p = blk->prev;
+        free_index_remove(h, p);
         p->size += header_size() + blk->size;
+        p->flags &= blk->flags;
         p->next = blk->next;
         if (p->next) p->next->prev = p; 
-        else g_tail = p;
+        else h->tail = p;
         g_free_bytes += header_size();
+        // next-fit's rover may rest on blk, whose header is about to vanish
+        if (h->rover == blk) h->rover = p;
+        if (p->flags & BLK_ZERO) memset(blk, 0, header_size());
         blk = p;
     }
+    free_index_insert(h, blk);
     return blk;
 }
\ No newline at end of file
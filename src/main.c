@@ -1,10 +1,34 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
 #include "jmalloc.h"
 
 typedef struct { int id; char name[16]; } Item;
 
+typedef struct { size_t mallocs, frees, reallocs; } HookCounts;
+
+static void count_malloc(void* p, size_t size, void* ctx){ (void)p; (void)size; ((HookCounts*)ctx)->mallocs++; }
+static void count_free(void* p, void* ctx){ (void)p; ((HookCounts*)ctx)->frees++; }
+static void count_realloc(void* o, void* n, size_t size, void* ctx){ (void)o; (void)n; (void)size; ((HookCounts*)ctx)->reallocs++; }
+
+static void on_soft_limit(size_t heap, size_t soft, void* ctx){
+    printf("soft limit crossed: heap=%zuB soft=%zuB\n", heap, soft);
+    ++*(int*)ctx;
+}
+
+static void write_file(const char* path, const char* text){
+    FILE* f = fopen(path, "w");
+    if (!f) return;
+    fputs(text, f);
+    fclose(f);
+}
+
+// two distinct call sites for the leak report (the memset keeps j_malloc from
+// being a tail call, which would report main as the site)
+static void* __attribute__((noinline)) leak_small(void){ return memset(j_malloc(48), 0, 48); }
+static void* __attribute__((noinline)) leak_large(void){ return memset(j_malloc(4096), 0, 4096); }
+
 static void stats(const char* tag){
     printf("[%s] heap=%zuB free=%zuB\n", tag, j_heap_bytes(), j_free_bytes());
 }
@@ -49,7 +73,236 @@ int main(void) {
     j_free(c);             
     stats("after coalesce trio");
 
-    // 4) cleanup
+    // 4) hooks: count operations while installed
+    HookCounts hc = {0, 0, 0};
+    j_hooks_t hooks = {0};
+    hooks.post_malloc = count_malloc;
+    hooks.post_free = count_free;
+    hooks.post_realloc = count_realloc;
+    hooks.ctx = &hc;
+    j_set_hooks(&hooks);
+    void* h = j_malloc(32);
+    h = j_realloc(h, 256);
+    j_free(h);
+    j_set_hooks(NULL);
+    printf("hooks: mallocs=%zu frees=%zu reallocs=%zu\n", hc.mallocs, hc.frees, hc.reallocs);
+
+    // 5) tags: attribute live bytes to subsystems
+    enum { TAG_CACHE = 1, TAG_PARSER = 2 };
+    void* c1 = j_malloc_tagged(TAG_CACHE, 200);
+    void* c2 = j_malloc_tagged(TAG_CACHE, 100);
+    void* p1 = j_malloc_tagged(TAG_PARSER, 64);
+    j_free(c2);
+    j_tag_usage_t usage[J_MAX_TAGS];
+    size_t ntags = j_tag_usage(usage, J_MAX_TAGS);
+    for (size_t i = 0; i < ntags; ++i) {
+        printf("tag %u: live=%lldB blocks=%lld allocs=%llu\n", usage[i].tag,
+               usage[i].live_bytes, usage[i].live_count, usage[i].total_allocs);
+    }
+    j_free(c1);
+    j_free(p1);
+
+    // 6) budget: soft limit callback, then hard failure
+    int soft_hits = 0;
+    j_set_budget(3u << 20, 5u << 20, on_soft_limit, &soft_hits);
+    void* big[16];
+    int nbig = 0;
+    while (nbig < 16 && (big[nbig] = j_malloc(900u << 10)) != NULL) nbig++;
+    printf("budget: got %d blocks before the hard limit, soft hits=%d\n", nbig, soft_hits);
+    stats("at hard limit");
+    for (int i = 0; i < nbig; ++i) j_free(big[i]);
+    j_set_budget(0, 0, NULL, NULL);
+    printf("trim released %zuB\n", j_trim());
+    stats("after trim");
+
+    // 7) pressure: stand-in PSI and cgroup files
+    write_file("psi.tmp", "some avg10=0.50 avg60=0.10 avg300=0.00 total=100\n");
+    write_file("cg_current.tmp", "990000000\n");
+    write_file("cg_high.tmp", "1000000000\n");
+    j_pressure_config_t pc = {0};
+    pc.psi_path = "psi.tmp";
+    pc.cgroup_current_path = "cg_current.tmp";
+    pc.cgroup_high_path = "cg_high.tmp";
+    void* spare = j_malloc(2u << 20);
+    j_free(spare);
+    stats("before pressure");
+    printf("pressure level=%d\n", j_pressure_enable(&pc));
+    stats("after pressure");
+    write_file("cg_current.tmp", "100000000\n");
+    printf("pressure level=%d\n", j_pressure_poll());
+    j_pressure_disable();
+    remove("psi.tmp");
+    remove("cg_current.tmp");
+    remove("cg_high.tmp");
+
+    // 8) j_buf: zero-copy slices share one refcounted block
+    j_slice_t msg = j_buf_alloc(32);
+    memcpy(msg.data, "HDR:hello-world", 16);
+    j_slice_t hdr = j_slice_sub(msg, 0, 3);
+    j_slice_t body = j_slice_sub(msg, 4, 11);
+    j_slice_release(msg); // parsers keep the views alive
+    printf("j_buf: hdr=%.*s body=%.*s refs=%zu\n", (int)hdr.len, (char*)hdr.data,
+           (int)body.len, (char*)body.data, j_slice_refs(body));
+    j_slice_release(hdr);
+    j_slice_release(body);
+
+    // 9) co-allocation: header + two arrays in one block
+    typedef struct { size_t n; int* ids; double* weights; } Record;
+    Record* rec;
+    size_t nrec = 5;
+    size_t sizes[3] = { sizeof(Record), nrec * sizeof(int), nrec * sizeof(double) };
+    size_t aligns[3] = { 8, 4, 64 };
+    void* parts[3];
+    void* block = j_malloc_multi(sizes, aligns, 3, parts);
+    rec = (Record*)parts[0];
+    rec->n = nrec;
+    rec->ids = (int*)parts[1];
+    rec->weights = (double*)parts[2];
+    for (size_t i = 0; i < nrec; ++i) { rec->ids[i] = (int)i; rec->weights[i] = i * 0.5; }
+    printf("multi: ids at +%td, weights at +%td (64-aligned=%d)\n",
+           (char*)rec->ids - (char*)rec, (char*)rec->weights - (char*)rec,
+           ((uintptr_t)rec->weights % 64) == 0);
+    j_free(block);
+
+    // 10) size classes: derive a 4-class table from a warm-up window
+    j_sizeclass_autotune(1000, 4);
+    void* warm[1000];
+    for (int i = 0; i < 1000; ++i) warm[i] = j_malloc(i % 4 == 0 ? 136 : (size_t)(40 + i % 61));
+    for (int i = 0; i < 1000; ++i) j_free(warm[i]);
+    unsigned long long hist[J_SIZECLASS_BINS];
+    size_t classes[J_SIZECLASS_MAX_COUNT];
+    double waste;
+    j_sizeclass_histogram(hist);
+    j_sizeclass_derive(hist, 4, classes, &waste);
+    size_t nc = j_sizeclass_get(classes, J_SIZECLASS_MAX_COUNT);
+    printf("size classes:");
+    for (size_t i = 0; i < nc; ++i) printf(" %zu", classes[i]);
+    printf(" (padding %.1f%%)\n", waste * 100);
+    j_sizeclass_save("sizeclasses.tmp");
+    j_sizeclass_set(NULL, 0);
+    int reloaded = j_sizeclass_load("sizeclasses.tmp");
+    printf("reloaded=%d classes=%zu\n", reloaded, j_sizeclass_get(NULL, 0));
+    remove("sizeclasses.tmp");
+    j_sizeclass_set(NULL, 0);
+
+    // 11) heap map: every other block freed and purged, then summed back per state
+    void* map_blk[64];
+    for (int i = 0; i < 64; ++i) map_blk[i] = j_malloc(16384);
+    for (int i = 0; i < 64; i += 2) j_free(map_blk[i]);
+    j_purge();
+    j_heap_map("heapmap.tmp");
+    FILE* mf = fopen("heapmap.tmp", "r");
+    char mline[128];
+    size_t pages = 0, by[4] = {0, 0, 0, 0};
+    while (mf && fgets(mline, sizeof(mline), mf)) {
+        size_t arena, group, page, b0, b1, b2, b3;
+        if (sscanf(mline, "%zu,%zu,%zu,%zu,%zu,%zu,%zu", &arena, &group, &page, &b0, &b1, &b2, &b3) != 7) continue;
+        pages++;
+        by[0] += b0; by[1] += b1; by[2] += b2; by[3] += b3;
+    }
+    if (mf) fclose(mf);
+    printf("heap map: pages=%zu alloc=%zu free=%zu purged=%zu meta=%zu (covers heap=%d)\n", pages,
+           by[0], by[1], by[2], by[3], by[0] + by[1] + by[2] + by[3] == j_heap_bytes());
+    remove("heapmap.tmp");
+    for (int i = 1; i < 64; i += 2) j_free(map_blk[i]);
+
+    // 12) pre-zeroing: dirty blocks are zeroed in the background, j_calloc then skips its memset
+    void* dirty[32];
+    for (int i = 0; i < 32; ++i) dirty[i] = memset(j_malloc(16384), 0xAB, 16384);
+    for (int i = 0; i < 32; ++i) j_free(dirty[i]);
+    j_zero_stats_t z0, z1;
+    j_zero_stats(&z0);
+    j_prezero(1u << 20);
+    time_t give_up = time(NULL) + 2;
+    do j_zero_stats(&z1); while (z1.zero_free_bytes < (1u << 19) && time(NULL) < give_up);
+    int all_zero = 1;
+    for (int i = 0; i < 32; ++i) {
+        unsigned char* c = (unsigned char*)j_calloc(1024, 16);
+        for (int b = 0; b < 16384; ++b) all_zero &= c[b] == 0;
+        dirty[i] = c;
+    }
+    j_prezero(0);
+    j_zero_stats(&z1);
+    printf("calloc: zeroed=%d memset skipped=%lluB done=%lluB (background zeroed %lluB)\n", all_zero,
+           z1.bytes_known_zero - z0.bytes_known_zero, z1.bytes_memset - z0.bytes_memset,
+           z1.bg_bytes_zeroed + z1.bg_bytes_purged);
+    for (int i = 0; i < 32; ++i) j_free(dirty[i]);
+
+    // 13) leak report: live blocks summed per allocation site, largest first
+    j_leak_tracking(1, 0);
+    void* leaks[8];
+    for (int i = 0; i < 6; ++i) leaks[i] = leak_small();
+    for (int i = 6; i < 8; ++i) leaks[i] = leak_large();
+    j_site_usage_t sites[8];
+    size_t nsites = j_leak_sites(sites, 8);
+    for (size_t i = 0; i < nsites && i < 8; ++i) {
+        if (sites[i].site) printf("leak site: blocks=%zu bytes=%zu\n", sites[i].blocks, sites[i].bytes);
+    }
+    for (int i = 0; i < 8; ++i) j_free(leaks[i]);
+    j_leak_tracking(0, 0);
+
+    // 14) per-thread stats: blocks handed to j_free_async are freed by the background thread
+    j_thread_name("demo-main");
+    void* handoff[100];
+    for (int i = 0; i < 100; ++i) handoff[i] = j_malloc(64);
+    for (int i = 0; i < 100; ++i) j_free_async(handoff[i]);
+    j_thread_stats_t ths[8];
+    size_t nth;
+    give_up = time(NULL) + 2;
+    for (;;) {
+        unsigned long long remote = 0;
+        nth = j_thread_stats(ths, 8);
+        for (size_t i = 0; i < nth && i < 8; ++i) remote += ths[i].remote_frees;
+        if (remote >= 100 || time(NULL) >= give_up) break;
+    }
+    for (size_t i = 0; i < nth && i < 8; ++i) {
+        printf("thread %llu %s: allocs=%llu frees=%llu remote frees=%llu heap grows=%llu\n", ths[i].id, ths[i].name,
+               ths[i].allocs, ths[i].frees, ths[i].remote_frees, ths[i].heap_grows);
+    }
+
+    // 15) handles: an idle object is compressed and comes back on the next lock
+    j_handle_t doc = j_handle_alloc(8192);
+    char* text = (char*)j_handle_lock(doc);
+    for (int i = 0; i < 8192; ++i) text[i] = "name=item;qty=1;"[i % 16];
+    j_handle_unlock(doc);
+    size_t swept = j_cold_sweep(0);
+    j_cold_stats_t cs;
+    j_cold_stats(&cs);
+    printf("cold: swept=%zu raw=%zuB compressed=%zuB ratio=%.1f\n", swept, cs.cold_raw_bytes, cs.cold_bytes, cs.ratio);
+    text = (char*)j_handle_lock(doc);
+    printf("cold: relocked intact=%d\n", memcmp(text + 8176, "name=item;qty=1;", 16) == 0);
+    j_handle_unlock(doc);
+    j_handle_free(doc);
+
+    // 16) thread cache: a list grows to the batch it keeps seeing, then serves it without the heap lock
+    j_thread_cache(16u << 10);
+    void* batch[32];
+    for (int r = 0; r < 50; ++r) {
+        for (int i = 0; i < 32; ++i) batch[i] = j_malloc(48);
+        for (int i = 0; i < 32; ++i) j_free(batch[i]);
+    }
+    j_tcache_stats_t tcs;
+    j_tcache_stats(&tcs);
+    const j_tcache_class_t* c48 = &tcs.classes[48 / 8 - 1];
+    printf("tcache: 48B capacity=%llu cached=%llu hits=%llu misses=%llu (granted %zuB of %zuB)\n", c48->max_capacity,
+           c48->cached, c48->hits, c48->misses, tcs.capacity_bytes, tcs.budget);
+    j_thread_cache(0);
+
+    // 17) flight recorder: a large allocation maps an arena, trimming unmaps it, the ring remembers both
+    void* huge = j_malloc(3u << 20);
+    j_free(huge);
+    j_trim();
+    FILE* fr = tmpfile();
+    if (fr) {
+        size_t nev = j_flight_dump(fileno(fr));
+        rewind(fr);
+        char line[160], last[160] = "";
+        while (fgets(line, sizeof(line), fr)) memcpy(last, line, sizeof(line));
+        fclose(fr);
+        printf("flight: %zu events, last: %s", nev, last);
+    }
+
+    // 18) cleanup
     j_free(arr);
     j_free(s);
     stats("end");
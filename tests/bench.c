@@ -1,8 +1,17 @@
+// expose fork, waitpid and friends under -std=c11
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#if !defined(_WIN32)
+    #include <unistd.h>
+    #include <sys/resource.h>
+    #include <sys/wait.h>
+#endif
 #include "jmalloc.h"
 
 #ifndef ALIGNMENT
@@ -50,11 +59,74 @@ static int check_pattern(const void* p, size_t sz, uint32_t stamp) {
     return 1;
 }
 
+// clock() counts CPU time of every thread, which would bill the reclaimer to the caller
+static double wall_ms(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// two call sites with different lifetimes for the site-group phase
+#define N_SITE 10000
+__attribute__((noinline)) static void* alloc_long_lived(size_t n) { return j_malloc(n); }
+__attribute__((noinline)) static void* alloc_short_lived(size_t n) { return j_malloc(n); }
+
+// one thread's burst for the thread heap phase: fill, then free everything
+#define N_BURST 16384
+static void* heap_burst(void* arg) {
+    void** blocks = (void**)arg;
+    for (int i = 0; i < N_BURST; ++i) blocks[i] = j_malloc(4096);
+    for (int i = 0; i < N_BURST; ++i) j_free(blocks[i]);
+    return NULL;
+}
+
+// thread cache phase: a thread warms one class, then sits idle holding its capacity
+#define TC_WIDTH 256
+static pthread_mutex_t tc_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tc_cv = PTHREAD_COND_INITIALIZER;
+static int tc_step = 0;
+static void tc_post(int step) {
+    pthread_mutex_lock(&tc_mu);
+    tc_step = step;
+    pthread_cond_broadcast(&tc_cv);
+    pthread_mutex_unlock(&tc_mu);
+}
+static void tc_wait(int step) {
+    pthread_mutex_lock(&tc_mu);
+    while (tc_step < step) pthread_cond_wait(&tc_cv, &tc_mu);
+    pthread_mutex_unlock(&tc_mu);
+}
+static void* tc_idle_worker(void* arg) {
+    (void)arg;
+    void* p[TC_WIDTH];
+    j_thread_name("tc-idle");
+    for (int r = 0; r < 200; ++r) {
+        for (int i = 0; i < TC_WIDTH; ++i) p[i] = j_malloc(128);
+        for (int i = 0; i < TC_WIDTH; ++i) j_free(p[i]);
+    }
+    tc_post(1); // warmed up
+    tc_wait(2); // main has turned the cache off
+    j_free(j_malloc(16));
+    tc_post(3);
+    tc_wait(4);
+    return NULL;
+}
+
 static void print_stats(const char* tag) {
     printf("[%s] heap=%zuB free=%zuB\n", tag, j_heap_bytes(), j_free_bytes());
 }
 
-int main(void) {
+// heap shape right after the churn phase, where fragmentation is worst
+typedef struct {
+    double ms;         // phases 1-5
+    size_t heap_bytes;
+    size_t free_bytes;
+    size_t largest_free;
+    size_t live_bytes;
+} SoakResult;
+
+// phases 1-5: alloc / realloc / partial free / churn / cleanup
+static int run_soak(SoakResult* res) {
     srand(42);
 
     Slot* slots = (Slot*)malloc(sizeof(Slot) * N_ALLOC);
@@ -63,6 +135,7 @@ int main(void) {
 
     clock_t t0, t1;
     double ms;
+    double total_ms = 0;
 
     // PHASE 1: 대량 할당
     t0 = clock();
@@ -86,6 +159,7 @@ int main(void) {
     }
     t1 = clock();
     ms = 1000.0 * (t1 - t0) / CLOCKS_PER_SEC;
+    total_ms += ms;
     printf("Phase1 alloc: items=%zu live_bytes=%zu time=%.2fms\n", live_count, live_bytes, ms);
     print_stats("after alloc");
 
@@ -135,6 +209,7 @@ int main(void) {
     }
     t1 = clock();
     ms = 1000.0 * (t1 - t0) / CLOCKS_PER_SEC;
+    total_ms += ms;
     printf("Phase2 realloc: applied=%zu time=%.2fms\n", realloc_ok, ms);
     print_stats("after realloc batch");
 
@@ -153,6 +228,7 @@ int main(void) {
     }
     t1 = clock();
     ms = 1000.0 * (t1 - t0) / CLOCKS_PER_SEC;
+    total_ms += ms;
     printf("Phase3 partial free: freed=%zu bytes=%zu time=%.2fms\n", freed_cnt, freed_bytes, ms);
     print_stats("after partial free");
 
@@ -201,8 +277,16 @@ int main(void) {
     }
     t1 = clock();
     ms = 1000.0 * (t1 - t0) / CLOCKS_PER_SEC;
+    total_ms += ms;
     printf("Phase4 churn: ops=%zu time=%.2fms\n", churn_ops, ms);
     print_stats("after churn");
+    res->heap_bytes = j_heap_bytes();
+    res->free_bytes = j_free_bytes();
+    res->largest_free = j_largest_free();
+    res->live_bytes = 0;
+    for (int i = 0; i < N_ALLOC; ++i) {
+        if (slots[i].live) res->live_bytes += slots[i].sz;
+    }
 
     // PHASE 5: 전부 해제 + 최종 확인
     t0 = clock();
@@ -217,9 +301,341 @@ int main(void) {
     }
     t1 = clock();
     ms = 1000.0 * (t1 - t0) / CLOCKS_PER_SEC;
+    total_ms += ms;
     printf("Phase5 cleanup: freed_left=%zu time=%.2fms\n", live_left, ms);
-    print_stats("end");
+    print_stats("after cleanup");
 
     free(slots);
+    res->ms = total_ms;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    // --policy NAME runs everything under one placement policy,
+    // --sweep runs phases 1-5 once per policy and compares them,
+    // --trace FILE records phases 1-5 for tools/jsim
+    int sweep = 0;
+    const char* trace = NULL;
+    for (int a = 1; a < argc; ++a) {
+        if (strcmp(argv[a], "--sweep") == 0) {
+            sweep = 1;
+        } else if (strcmp(argv[a], "--policy") == 0 && a + 1 < argc) {
+            const char* name = argv[++a];
+            int p = 0;
+            while (p < J_POLICY_COUNT && strcmp(j_policy_name((j_policy_t)p), name) != 0) ++p;
+            ASSERT(p < J_POLICY_COUNT, "unknown policy");
+            j_set_policy((j_policy_t)p);
+        } else if (strcmp(argv[a], "--trace") == 0 && a + 1 < argc) {
+            trace = argv[++a];
+        } else {
+            fprintf(stderr, "usage: %s [--policy first|next|best|address] [--sweep] [--trace FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (sweep) {
+        SoakResult res[J_POLICY_COUNT];
+        for (int p = 0; p < J_POLICY_COUNT; ++p) {
+            j_set_policy((j_policy_t)p);
+            printf("== policy %s ==\n", j_policy_name((j_policy_t)p));
+            if (run_soak(&res[p])) return 1;
+            j_trim(); // start the next policy from an empty heap
+        }
+        // fragmentation: share of free memory outside the largest free block
+        printf("\npolicy    time(ms)  heap(B)    free(B)    largest(B)  live(B)    overhead  frag\n");
+        for (int p = 0; p < J_POLICY_COUNT; ++p) {
+            double frag = res[p].free_bytes ? 1.0 - (double)res[p].largest_free / (double)res[p].free_bytes : 0.0;
+            printf("%-8s  %8.1f  %-9zu  %-9zu  %-10zu  %-9zu  %.2fx     %.3f\n", j_policy_name((j_policy_t)p), res[p].ms,
+                   res[p].heap_bytes, res[p].free_bytes, res[p].largest_free, res[p].live_bytes,
+                   (double)res[p].heap_bytes / (double)res[p].live_bytes, frag);
+        }
+        return 0;
+    }
+
+    printf("policy: %s\n", j_policy_name(j_get_policy()));
+    SoakResult soak;
+    ASSERT(!trace || j_trace_start(trace) == 0, "cannot open trace file");
+    if (run_soak(&soak)) return 1;
+    if (trace) j_trace_stop();
+    double ms;
+
+    // PHASE 6: 큰 구조체 해제 비용 (j_free vs j_free_async)
+    #define N_NODES 20000
+    void** nodes = (void**)malloc(sizeof(void*) * N_NODES);
+    ASSERT(nodes, "host malloc for nodes failed");
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < N_NODES; ++i) {
+            nodes[i] = j_malloc((size_t)(rand() % 96) + 16);
+            ASSERT(nodes[i], "node alloc failed");
+        }
+        double w0 = wall_ms();
+        for (int i = 0; i < N_NODES; ++i) {
+            if (round == 0) j_free(nodes[i]);
+            else j_free_async(nodes[i]);
+        }
+        ms = wall_ms() - w0;
+        printf("Phase6 %s: nodes=%d caller time=%.2fms\n", round == 0 ? "j_free      " : "j_free_async", N_NODES, ms);
+    }
+    j_free_async_flush();
+    free(nodes);
+
+    // PHASE 7: call-site groups — a long-lived site interleaved with a short-lived one
+    void** keep = (void**)malloc(sizeof(void*) * N_SITE);
+    void** tmp = (void**)malloc(sizeof(void*) * N_SITE);
+    ASSERT(keep && tmp, "host malloc for site phase failed");
+    for (unsigned groups = 0; groups <= 4; groups += 4) {
+        j_trim();
+        j_site_groups(groups);
+        for (int i = 0; i < N_SITE; ++i) {
+            keep[i] = alloc_long_lived((size_t)(rand() % 192) + 64);
+            tmp[i] = alloc_short_lived((size_t)(rand() % 1792) + 256);
+            ASSERT(keep[i] && tmp[i], "site alloc failed");
+        }
+        for (int i = 0; i < N_SITE; ++i) j_free(tmp[i]);
+        j_arena_stats_t st;
+        j_arena_stats(&st);
+        size_t trimmed = j_trim();
+        printf("Phase7 site groups=%u: arenas=%zu empty=%zu sparse=%zu live=%zuB trimmed=%zuB\n",
+               groups, st.arenas, st.empty_arenas, st.sparse_arenas, st.live_bytes, trimmed);
+        for (int i = 0; i < N_SITE; ++i) j_free(keep[i]);
+    }
+    j_site_groups(0);
+
+    // PHASE 8: leak tracking — hot path cost, then one site left holding blocks
+    #define N_LEAK_OPS 1000000
+    for (int on = 0; on <= 1; ++on) {
+        ASSERT(j_leak_tracking(on, 0) == 0, "leak tracking failed to start");
+        double w0 = wall_ms();
+        for (int i = 0; i < N_LEAK_OPS; ++i) j_free(j_malloc((size_t)(i & 255) + 16));
+        ms = wall_ms() - w0;
+        printf("Phase8 leak tracking %s: %d malloc/free pairs time=%.2fms\n", on ? "on " : "off", N_LEAK_OPS, ms);
+    }
+    for (int i = 0; i < N_SITE; ++i) {
+        keep[i] = j_malloc(128);
+        ASSERT(keep[i], "leak alloc failed");
+    }
+    j_site_usage_t top[4];
+    size_t nsites = j_leak_sites(top, 4);
+    ASSERT(nsites >= 1 && top[0].site && top[0].blocks == N_SITE, "leaked blocks not attributed to one site");
+    printf("Phase8 leak report: sites=%zu top=%p blocks=%zu bytes=%zu\n", nsites, top[0].site, top[0].blocks, top[0].bytes);
+    for (int i = 0; i < N_SITE; ++i) j_free(keep[i]);
+    // realloc(NULL, n) is an allocation of its own caller, not of site NULL
+    void* grown = j_realloc(NULL, 8u << 20);
+    ASSERT(grown, "realloc from NULL failed");
+    nsites = j_leak_sites(top, 4);
+    ASSERT(nsites >= 1 && top[0].site && top[0].blocks == 1 && top[0].bytes >= (8u << 20),
+           "realloc from NULL not attributed to its caller");
+    j_free(grown);
+    j_leak_tracking(0, 0);
+    free(keep);
+    free(tmp);
+
+    // PHASE 9: purging a fragmented heap — every other 12 KiB block free
+    #define N_PURGE 8192
+    void** spans = (void**)malloc(sizeof(void*) * N_PURGE);
+    ASSERT(spans, "host malloc for purge phase failed");
+    j_trim();
+    for (int i = 0; i < N_PURGE; ++i) {
+        spans[i] = j_malloc(12u << 10);
+        ASSERT(spans[i], "purge span alloc failed");
+        memset(spans[i], 0x5C, 12u << 10);
+    }
+    for (int i = 0; i < N_PURGE; i += 2) j_free(spans[i]);
+    j_purge_stats_t ps0, ps1;
+    j_purge_stats(&ps0);
+    double w0 = wall_ms();
+    size_t purged = j_purge();
+    ms = wall_ms() - w0;
+    j_purge_stats(&ps1);
+    unsigned long long calls = ps1.syscalls - ps0.syscalls;
+    printf("Phase9 purge: purged=%zuB ranges=%llu syscalls=%llu (%.1f per GiB, batched=%d) time=%.2fms\n",
+           purged, ps1.ranges - ps0.ranges, calls, purged ? (double)calls * (1u << 30) / (double)purged : 0.0,
+           ps1.batched, ms);
+    for (int i = 1; i < N_PURGE; i += 2) ASSERT(((unsigned char*)spans[i])[0] == 0x5C, "purge touched a live block");
+    for (int i = 1; i < N_PURGE; i += 2) j_free(spans[i]);
+    free(spans);
+
+    // PHASE 10: cold compression — a cache of record-like objects, most left idle
+    #define N_COLD 20000
+    #define COLD_SZ 1024
+    j_handle_t* objs = (j_handle_t*)malloc(sizeof(j_handle_t) * N_COLD);
+    ASSERT(objs, "host malloc for cold phase failed");
+    for (int i = 0; i < N_COLD; ++i) {
+        objs[i] = j_handle_alloc(COLD_SZ);
+        ASSERT(objs[i], "handle alloc failed");
+        char* p = (char*)j_handle_lock(objs[i]);
+        int off = 0;
+        while (off < COLD_SZ) {
+            off += snprintf(p + off, (size_t)(COLD_SZ - off), "{\"id\":%d,\"user\":\"u%05d\",\"score\":%d},", i, rand() % 50000, rand() % 1000);
+            if (off >= COLD_SZ) break;
+        }
+        j_handle_unlock(objs[i]);
+    }
+    w0 = wall_ms();
+    size_t cold = j_cold_sweep(0);
+    ms = wall_ms() - w0;
+    j_cold_stats_t cst;
+    j_cold_stats(&cst);
+    printf("Phase10 cold sweep: compressed=%zu of %d raw=%zuB cold=%zuB ratio=%.2f time=%.2fms (%.0f MB/s)\n", cold,
+           N_COLD, cst.cold_raw_bytes, cst.cold_bytes, cst.ratio, ms, ms > 0 ? cst.cold_raw_bytes / 1e3 / ms : 0.0);
+    // touch a tenth of them: the first lock of each decompresses
+    for (int i = 0; i < N_COLD; i += 10) {
+        char* p = (char*)j_handle_lock(objs[i]);
+        ASSERT(p && p[0] == '{', "cold object came back damaged");
+        j_handle_unlock(objs[i]);
+    }
+    j_cold_stats(&cst);
+    printf("Phase10 cold locks: %llu decompressed avg=%lluns max=%lluns, cold now=%zu arena=%zuB\n", cst.cold_locks,
+           cst.cold_lock_ns_avg, cst.cold_lock_ns_max, cst.cold_handles, cst.arena_bytes);
+    for (int i = 0; i < N_COLD; ++i) j_handle_free(objs[i]);
+    free(objs);
+
+    // PHASE 11: per-thread heaps — threads take turns allocating and freeing 64 MiB;
+    // each new thread steals the empty arenas the last one left in its heap
+    void** burst = (void**)malloc(sizeof(void*) * N_BURST);
+    ASSERT(burst, "host malloc for burst phase failed");
+    j_trim();
+    j_thread_heaps(4);
+    j_arena_stats_t as0, as1;
+    j_arena_stats(&as0);
+    size_t peak = 0;
+    for (int round = 0; round < 8; ++round) {
+        pthread_t t;
+        ASSERT(pthread_create(&t, NULL, heap_burst, burst) == 0, "burst thread failed to start");
+        pthread_join(t, NULL);
+        if (j_heap_bytes() > peak) peak = j_heap_bytes();
+    }
+    j_arena_stats(&as1);
+    printf("Phase11 thread heaps=4: 8 bursts of %dx4KiB, heap peak=%zuB steals=%llu (%lluB)\n", N_BURST, peak,
+           as1.steals - as0.steals, as1.stolen_bytes - as0.stolen_bytes);
+    ASSERT(peak < 2 * (size_t)N_BURST * 4096, "thread heaps kept mapping new arenas");
+    j_thread_heaps(0);
+    free(burst);
+
+    // PHASE 12: adaptive thread cache — batches of a hot 64 B class with a cold
+    // 400 B class on the side, then a second thread's idle capacity taken back
+    #define TC_ROUNDS 4000
+    void* tcb[TC_WIDTH];
+    for (int on = 0; on <= 1; ++on) {
+        j_thread_cache(on ? 64u << 10 : 0);
+        w0 = wall_ms();
+        for (int r = 0; r < TC_ROUNDS; ++r) {
+            for (int i = 0; i < TC_WIDTH; ++i) tcb[i] = j_malloc(64);
+            for (int i = 0; i < TC_WIDTH; ++i) j_free(tcb[i]);
+            if (r % 64 == 0) {
+                for (int i = 0; i < 8; ++i) tcb[i] = j_malloc(400);
+                for (int i = 0; i < 8; ++i) j_free(tcb[i]);
+            }
+        }
+        ms = wall_ms() - w0;
+        printf("Phase12 thread cache %s: %d malloc/free pairs time=%.2fms\n", on ? "on " : "off",
+               TC_ROUNDS * TC_WIDTH, ms);
+    }
+    j_tcache_stats_t tcs;
+    j_tcache_stats(&tcs);
+    const j_tcache_class_t* hot = &tcs.classes[64 / ALIGNMENT - 1];
+    const j_tcache_class_t* cool = &tcs.classes[400 / ALIGNMENT - 1];
+    printf("Phase12 capacities: 64B=%llu (hits=%llu misses=%llu overflows=%llu) 400B=%llu (hits=%llu misses=%llu)\n",
+           hot->max_capacity, hot->hits, hot->misses, hot->overflows, cool->max_capacity, cool->hits, cool->misses);
+    ASSERT(hot->max_capacity >= TC_WIDTH && hot->hits > 9 * hot->misses, "hot class did not grow to its working set");
+    ASSERT(cool->max_capacity < hot->max_capacity, "cold class kept as much capacity as the hot one");
+    // blocks parked in the cache are not live to the arena walk
+    j_arena_stats(&as0);
+    for (int i = 0; i < TC_WIDTH; ++i) tcb[i] = j_malloc(64);
+    j_arena_stats(&as1);
+    for (int i = 0; i < TC_WIDTH; ++i) j_free(tcb[i]);
+    ASSERT(as1.live_bytes >= as0.live_bytes + TC_WIDTH * 64, "cached blocks were counted as live");
+
+    // the idle thread holds about 32 KiB of 128 B capacity; main's 256 B batches need it
+    pthread_t idle;
+    ASSERT(pthread_create(&idle, NULL, tc_idle_worker, NULL) == 0, "thread cache worker failed to start");
+    tc_wait(1);
+    j_thread_stats_t tst[16];
+    size_t nts = j_thread_stats(tst, 16);
+    size_t idle_before = 0, idle_after = 0;
+    for (size_t i = 0; i < nts && i < 16; ++i) if (!strcmp(tst[i].name, "tc-idle")) idle_before = tst[i].tcache_capacity_bytes;
+    j_tcache_stats(&tcs);
+    unsigned long long steals0 = tcs.steals;
+    for (int r = 0; r < 200; ++r) {
+        for (int i = 0; i < TC_WIDTH; ++i) tcb[i] = j_malloc(256);
+        for (int i = 0; i < TC_WIDTH; ++i) j_free(tcb[i]);
+    }
+    nts = j_thread_stats(tst, 16);
+    for (size_t i = 0; i < nts && i < 16; ++i) if (!strcmp(tst[i].name, "tc-idle")) idle_after = tst[i].tcache_capacity_bytes;
+    j_tcache_stats(&tcs);
+    printf("Phase12 budget=%zuB: granted=%zuB, idle thread %zuB -> %zuB, steals=%llu\n", tcs.budget,
+           tcs.capacity_bytes, idle_before, idle_after, tcs.steals - steals0);
+    ASSERT(tcs.capacity_bytes <= tcs.budget, "thread caches exceeded their budget");
+    ASSERT(idle_after < idle_before, "idle thread kept its cache capacity");
+    // high memory pressure cuts the budget to a quarter and takes the excess back at once
+    FILE* psi = fopen("bench_psi.tmp", "w");
+    ASSERT(psi, "cannot write the stand-in PSI file");
+    fputs("some avg10=30.00 avg60=10.00 avg300=1.00 total=100\n", psi);
+    fclose(psi);
+    j_pressure_config_t pc = {0};
+    pc.psi_path = "bench_psi.tmp";
+    pc.cgroup_current_path = pc.cgroup_high_path = "bench_no_cgroup.tmp";
+    size_t granted = tcs.capacity_bytes;
+    int level = j_pressure_enable(&pc);
+    j_tcache_stats(&tcs);
+    printf("Phase12 pressure level=%d: granted %zuB -> %zuB\n", level, granted, tcs.capacity_bytes);
+    ASSERT(level == J_PRESSURE_HIGH && tcs.capacity_bytes <= tcs.budget / 4, "thread caches kept their budget under pressure");
+    j_pressure_disable();
+    remove("bench_psi.tmp");
+    // turning the cache off empties the idle thread's lists on its next free
+    size_t idle_cached = 0;
+    nts = j_thread_stats(tst, 16);
+    for (size_t i = 0; i < nts && i < 16; ++i) if (!strcmp(tst[i].name, "tc-idle")) idle_cached = tst[i].tcache_bytes;
+    j_thread_cache(0);
+    j_tcache_stats(&tcs);
+    ASSERT(tcs.capacity_bytes == 0, "capacity still granted after the cache was turned off");
+    tc_post(2);
+    tc_wait(3);
+    nts = j_thread_stats(tst, 16);
+    size_t idle_left = 1;
+    for (size_t i = 0; i < nts && i < 16; ++i) if (!strcmp(tst[i].name, "tc-idle")) idle_left = tst[i].tcache_bytes;
+    printf("Phase12 cache off: idle thread held %zuB, %zuB after its next free\n", idle_cached, idle_left);
+    ASSERT(idle_cached > 0 && idle_left == 0, "idle thread kept its cached blocks after the cache was turned off");
+    tc_post(4);
+    pthread_join(idle, NULL);
+
+#if !defined(_WIN32)
+    // PHASE 13: flight recorder — a child maps a large block, then faults; its
+    // crash handler leaves the ring in a file and the signal still kills it
+    // (POSIX only: it needs fork)
+    char fr_path[64];
+    snprintf(fr_path, sizeof(fr_path), "/tmp/jmalloc-flight-bench.%d.log", (int)getpid());
+    pid_t child = fork();
+    ASSERT(child >= 0, "fork failed");
+    if (child == 0) {
+        struct rlimit no_core = { 0, 0 };
+        setrlimit(RLIMIT_CORE, &no_core);
+        if (j_flight_recorder(fr_path, 0) != 0) _exit(2);
+        volatile char* big = (volatile char*)j_malloc(4u << 20);
+        big[0] = 1;
+        volatile int* volatile wild = NULL;
+        *wild = 1;
+        _exit(3);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    FILE* frf = fopen(fr_path, "r");
+    ASSERT(frf, "crash handler wrote no flight recorder dump");
+    char frl[256];
+    int fr_lines = 0, fr_signal = 0, fr_large = 0;
+    while (fgets(frl, sizeof(frl), frf)) {
+        fr_lines++;
+        if (strstr(frl, "signal=11")) fr_signal = 1;
+        if (strstr(frl, "large_alloc") && strstr(frl, "size=4194304")) fr_large = 1;
+    }
+    fclose(frf);
+    unlink(fr_path);
+    printf("Phase13 flight recorder: child %s by signal %d, dump lines=%d large_alloc=%d\n",
+           WIFSIGNALED(status) ? "killed" : "exited", WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status),
+           fr_lines, fr_large);
+    ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV, "crash handler swallowed the signal");
+    ASSERT(fr_signal && fr_large, "dump is missing the crash or the large allocation");
+#endif
+    print_stats("end");
     return 0;
 }
@@ -0,0 +1,170 @@
+// coroutine frame allocation benchmark: default operator new vs jmalloc_coro
+// ping-pong: a parent coroutine awaits a freshly created child on every step,
+// so each step allocates and frees one frame on the same thread.
+// handoff: one thread creates suspended coroutines, another resumes and
+// destroys them, so every frame goes back through the remote-free list.
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "jmalloc_coro.hpp"
+
+#define PING_STEPS 2000000
+#define HANDOFFS   200000
+#define BATCH      256
+
+struct default_frame {};
+
+template <class Frame>
+struct task {
+    struct promise_type : Frame {
+        long value = 0;
+
+        task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_value(long v) { value = v; }
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> h;
+
+    explicit task(std::coroutine_handle<promise_type> handle) : h(handle) {}
+    task(task&& o) noexcept : h(o.h) { o.h = nullptr; }
+    task(const task&) = delete;
+    ~task() { if (h) h.destroy(); }
+
+    bool await_ready() noexcept { return false; }
+    // children never suspend midway, so run them inline and keep the stack flat
+    bool await_suspend(std::coroutine_handle<>) noexcept {
+        h.resume();
+        return false;
+    }
+    long await_resume() noexcept { return h.promise().value; }
+
+    // run to completion from plain code
+    long get() {
+        h.resume();
+        return h.promise().value;
+    }
+    std::coroutine_handle<promise_type> release() {
+        auto r = h;
+        h = nullptr;
+        return r;
+    }
+};
+
+template <class Frame>
+task<Frame> pong(long i) {
+    co_return i + 1;
+}
+
+template <class Frame>
+task<Frame> ping(long steps) {
+    long sum = 0;
+    for (long i = 0; i < steps; ++i) sum += co_await pong<Frame>(i);
+    co_return sum;
+}
+
+static double wall_ms() {
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+template <class Frame>
+static double run_ping(long* result) {
+    double t0 = wall_ms();
+    *result = ping<Frame>(PING_STEPS).get();
+    return wall_ms() - t0;
+}
+
+template <class Frame>
+static double run_handoff(long* result) {
+    using handle = std::coroutine_handle<typename task<Frame>::promise_type>;
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<std::vector<handle>> queue;
+    bool done = false;
+    long sum = 0;
+
+    double t0 = wall_ms();
+    std::thread consumer([&] {
+        for (;;) {
+            std::vector<handle> batch;
+            {
+                std::unique_lock<std::mutex> lk(mu);
+                cv.wait(lk, [&] { return done || !queue.empty(); });
+                if (queue.empty()) return;
+                batch = std::move(queue.front());
+                queue.pop_front();
+            }
+            for (handle h : batch) {
+                h.resume();
+                sum += h.promise().value;
+                h.destroy(); // frame goes back to the producer's cache
+            }
+        }
+    });
+
+    std::vector<handle> batch;
+    for (long i = 0; i < HANDOFFS; ++i) {
+        batch.push_back(pong<Frame>(i).release());
+        if (batch.size() == BATCH || i + 1 == HANDOFFS) {
+            std::lock_guard<std::mutex> lk(mu);
+            queue.push_back(std::move(batch));
+            batch.clear();
+            cv.notify_one();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        done = true;
+    }
+    cv.notify_one();
+    consumer.join();
+    *result = sum;
+    return wall_ms() - t0;
+}
+
+int main() {
+    const long want_ping = (long)PING_STEPS * (PING_STEPS + 1) / 2;
+    const long want_handoff = (long)HANDOFFS * (HANDOFFS + 1) / 2;
+    long r1, r2, r3, r4;
+
+    // warm both allocators once so the timed runs compare steady state
+    run_ping<default_frame>(&r1);
+    run_ping<jmalloc::recycled_frame>(&r2);
+
+    double d_ping = run_ping<default_frame>(&r1);
+    double j_ping = run_ping<jmalloc::recycled_frame>(&r2);
+    std::printf("ping-pong %d steps: default %.2fms (%.1f ns/frame), jmalloc_coro %.2fms (%.1f ns/frame)\n",
+                PING_STEPS, d_ping, d_ping * 1e6 / PING_STEPS, j_ping, j_ping * 1e6 / PING_STEPS);
+
+    double d_hand = run_handoff<default_frame>(&r3);
+    double j_hand = run_handoff<jmalloc::recycled_frame>(&r4);
+    std::printf("cross-thread %d frames: default %.2fms, jmalloc_coro %.2fms\n", HANDOFFS, d_hand, j_hand);
+
+    if (r1 != want_ping || r2 != want_ping || r3 != want_handoff || r4 != want_handoff) {
+        std::fprintf(stderr, "FAIL: wrong coroutine results\n");
+        return 1;
+    }
+
+    // a frame freed after its owner thread exits must still be released
+    std::coroutine_handle<task<jmalloc::recycled_frame>::promise_type> orphan;
+    std::thread([&] { orphan = pong<jmalloc::recycled_frame>(41).release(); }).join();
+    orphan.resume();
+    long v = orphan.promise().value;
+    orphan.destroy();
+    if (v != 42) {
+        std::fprintf(stderr, "FAIL: orphaned frame\n");
+        return 1;
+    }
+    std::printf("coro_bench: OK\n");
+    return 0;
+}
@@ -0,0 +1,138 @@
+// O_DIRECT read benchmark: j_iobuf pool vs posix_memalign (Linux)
+// reads random block-aligned ranges of a scratch file into freshly allocated
+// buffers, then compares time and the memory each allocator maps for a batch
+// of live buffers
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <malloc.h>
+#include "jmalloc.h"
+
+#define FILE_SIZE  (64u << 20)
+#define BLOCK      4096u
+#define READS      20000
+#define LIVE_BUFS  2000
+#define MAX_BLOCKS 16   // each read is 1..16 blocks
+
+#define ASSERT(cond, msg) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "ASSERT FAIL: %s (line %d, errno=%d)\n", msg, __LINE__, errno); \
+        return 1; \
+    } \
+} while (0)
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void* pm_alloc(size_t len) {
+    void* p = NULL;
+    return posix_memalign(&p, BLOCK, len) == 0 ? p : NULL;
+}
+
+// bytes glibc has mapped for the main heap plus mmap'd chunks
+static size_t libc_footprint(void) {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.arena + mi.hblkhd;
+}
+
+typedef struct {
+    const char* name;
+    void* (*alloc)(size_t);
+    void (*release)(void*);
+} Pool;
+
+static int run_reads(const Pool* pool, int fd, unsigned seed, double* ms_out, size_t* bytes_out) {
+    srand(seed);
+    size_t bytes = 0;
+    double t0 = now_ms();
+    for (int i = 0; i < READS; ++i) {
+        size_t len = (size_t)(rand() % MAX_BLOCKS + 1) * BLOCK;
+        off_t off = (off_t)(rand() % (FILE_SIZE / BLOCK - MAX_BLOCKS)) * BLOCK;
+        void* buf = pool->alloc(len);
+        ASSERT(buf && ((uintptr_t)buf % BLOCK) == 0, "buffer not block aligned");
+        ssize_t n = pread(fd, buf, len, off);
+        ASSERT(n == (ssize_t)len, "pread");
+        ASSERT(((unsigned char*)buf)[0] == (unsigned char)(off / BLOCK), "wrong data");
+        bytes += (size_t)n;
+        pool->release(buf);
+    }
+    *ms_out = now_ms() - t0;
+    *bytes_out = bytes;
+    return 0;
+}
+
+int main(void) {
+    char path[] = "./iobuf_bench_XXXXXX";
+    int wfd = mkstemp(path);
+    ASSERT(wfd >= 0, "mkstemp");
+
+    // each block starts with its own index so reads can be checked
+    unsigned char* chunk = malloc(1u << 20);
+    ASSERT(chunk, "malloc chunk");
+    for (size_t off = 0; off < FILE_SIZE; off += 1u << 20) {
+        for (size_t b = 0; b < (1u << 20); b += BLOCK) memset(chunk + b, (int)((off + b) / BLOCK), BLOCK);
+        ASSERT(write(wfd, chunk, 1u << 20) == (ssize_t)(1u << 20), "write scratch file");
+    }
+    free(chunk);
+    fsync(wfd);
+    close(wfd);
+
+    int fd = open(path, O_RDONLY | O_DIRECT);
+    int direct = fd >= 0;
+    if (!direct) fd = open(path, O_RDONLY); // e.g. tmpfs has no O_DIRECT
+    ASSERT(fd >= 0, "open scratch file");
+    printf("file=%uMiB reads=%d O_DIRECT=%s\n", FILE_SIZE >> 20, READS, direct ? "yes" : "no (buffered fallback)");
+
+    Pool pools[2] = {
+        { "posix_memalign", pm_alloc, free },
+        { "j_iobuf",        j_iobuf_alloc, j_iobuf_free },
+    };
+    for (int p = 0; p < 2; ++p) {
+        double ms;
+        size_t bytes;
+        if (run_reads(&pools[p], fd, 42, &ms, &bytes)) return 1;
+        printf("%-15s reads: %.2fms (%.1f MiB/s)\n", pools[p].name, ms, bytes / (1024.0 * 1024.0) / (ms / 1000.0));
+    }
+
+    // footprint of LIVE_BUFS buffers held at once
+    void** live = malloc(sizeof(void*) * LIVE_BUFS);
+    ASSERT(live, "malloc live");
+    size_t want = 0;
+    srand(7);
+    size_t before = libc_footprint();
+    for (int i = 0; i < LIVE_BUFS; ++i) {
+        size_t len = (size_t)(rand() % MAX_BLOCKS + 1) * BLOCK;
+        live[i] = pm_alloc(len);
+        ASSERT(live[i], "posix_memalign");
+        want += len;
+    }
+    size_t pm_bytes = libc_footprint() - before;
+    for (int i = 0; i < LIVE_BUFS; ++i) free(live[i]);
+
+    // spans kept from the read phase count too, so this is an upper bound
+    srand(7);
+    for (int i = 0; i < LIVE_BUFS; ++i) {
+        size_t len = (size_t)(rand() % MAX_BLOCKS + 1) * BLOCK;
+        live[i] = j_iobuf_alloc(len);
+        ASSERT(live[i] && j_iobuf_size(live[i]) >= len, "j_iobuf_alloc");
+    }
+    size_t jb_bytes = j_iobuf_bytes();
+    for (int i = 0; i < LIVE_BUFS; ++i) j_iobuf_free(live[i]);
+    free(live);
+
+    printf("live %d buffers, %zuB requested: posix_memalign maps %zuB (%.2fx), j_iobuf maps %zuB (%.2fx)\n",
+           LIVE_BUFS, want, pm_bytes, (double)pm_bytes / want, jb_bytes, (double)jb_bytes / want);
+
+    close(fd);
+    unlink(path);
+    return 0;
+}
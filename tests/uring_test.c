@@ -0,0 +1,162 @@
+// io_uring registered-buffer mode test (Linux only)
+// sets up a raw ring, attaches the heap, and moves data through a pipe and a
+// temp file with WRITE_FIXED / READ_FIXED straight from j_malloc'd memory
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "jmalloc.h"
+
+#define ASSERT(cond, msg) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "ASSERT FAIL: %s (line %d, errno=%d)\n", msg, __LINE__, errno); \
+        return 1; \
+    } \
+} while (0)
+
+// minimal ring: one submission and one completion at a time
+typedef struct {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+} Ring;
+
+static int ring_init(Ring *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) return -1;
+
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_len > sq_len) sq_len = cq_len;
+        cq_len = sq_len;
+    }
+    uint8_t *sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) return -1;
+    uint8_t *cq = sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) return -1;
+    }
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) return -1;
+
+    r->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + p.sq_off.array);
+    r->cq_head = (unsigned*)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+// submit one fixed-buffer op and wait for its result
+static int ring_fixed_io(Ring *r, int op, int fd, void *buf, unsigned len, int buf_index, unsigned long long off) {
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (unsigned char)op;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->buf_index = (unsigned short)buf_index;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (syscall(__NR_io_uring_enter, r->fd, 1, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) return -errno;
+
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) return -EAGAIN;
+    int res = r->cqes[head & *r->cq_mask].res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return res;
+}
+
+int main(void) {
+    Ring ring;
+    if (ring_init(&ring, 8) != 0) {
+        printf("io_uring unavailable (errno=%d), skipping\n", errno);
+        return 0;
+    }
+
+    // an arena mapped before attach must be registered too
+    void *early = j_malloc(64);
+    ASSERT(early, "j_malloc before attach");
+    ASSERT(j_uring_buf_index(early) == -1, "index before attach");
+
+    ASSERT(j_uring_attach(ring.fd, 16) == 0, "j_uring_attach");
+    int early_idx = j_uring_buf_index(early);
+    ASSERT(early_idx >= 0, "existing arena not registered");
+
+    // pipe round trip: WRITE_FIXED from one block, READ_FIXED into another
+    int pfd[2];
+    ASSERT(pipe(pfd) == 0, "pipe");
+    const unsigned len = 4096;
+    char *src = j_malloc(len);
+    char *dst = j_malloc(len);
+    ASSERT(src && dst, "j_malloc buffers");
+    for (unsigned i = 0; i < len; ++i) src[i] = (char)(i * 7 + 1);
+    memset(dst, 0, len);
+
+    int res = ring_fixed_io(&ring, IORING_OP_WRITE_FIXED, pfd[1], src, len, j_uring_buf_index(src), 0);
+    ASSERT(res == (int)len, "pipe WRITE_FIXED");
+    res = ring_fixed_io(&ring, IORING_OP_READ_FIXED, pfd[0], dst, len, j_uring_buf_index(dst), 0);
+    ASSERT(res == (int)len, "pipe READ_FIXED");
+    ASSERT(memcmp(src, dst, len) == 0, "pipe data mismatch");
+    printf("pipe: %u bytes via fixed buffer %d\n", len, j_uring_buf_index(src));
+
+    // a block big enough to need its own arena gets a fresh slot
+    const unsigned big_len = 3u << 20;
+    char *big = j_malloc(big_len);
+    ASSERT(big, "j_malloc big");
+    int big_idx = j_uring_buf_index(big);
+    ASSERT(big_idx >= 0 && big_idx != early_idx, "new arena not registered");
+
+    // file round trip through the new arena
+    char path[] = "/tmp/jmalloc_uring_XXXXXX";
+    int ffd = mkstemp(path);
+    ASSERT(ffd >= 0, "mkstemp");
+    unlink(path);
+    for (unsigned i = 0; i < big_len; ++i) big[i] = (char)(i ^ (i >> 8));
+    res = ring_fixed_io(&ring, IORING_OP_WRITE_FIXED, ffd, big, big_len, big_idx, 0);
+    ASSERT(res == (int)big_len, "file WRITE_FIXED");
+    memset(dst, 0, len);
+    res = ring_fixed_io(&ring, IORING_OP_READ_FIXED, ffd, dst, len, j_uring_buf_index(dst), 4096);
+    ASSERT(res == (int)len, "file READ_FIXED");
+    ASSERT(memcmp(dst, big + 4096, len) == 0, "file data mismatch");
+    printf("file: %u bytes written from fixed buffer %d\n", big_len, big_idx);
+
+    // trimming the freed arena releases its slot
+    j_free(big);
+    j_trim();
+    char *again = j_malloc(big_len);
+    ASSERT(again && j_uring_buf_index(again) == big_idx, "slot not reused after trim");
+
+    j_free(again);
+    j_free(src);
+    j_free(dst);
+    j_free(early);
+    j_uring_detach();
+    ASSERT(j_uring_buf_index(early) == -1, "index after detach");
+    close(ffd);
+    close(pfd[0]);
+    close(pfd[1]);
+    close(ring.fd);
+    printf("uring_test: OK\n");
+    return 0;
+}
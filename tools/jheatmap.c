@@ -0,0 +1,171 @@
+// jheatmap: render a heap map (j_heap_map, jsim --map) as a PPM image or text
+// every page is one cell, pages of an arena run left to right in rows of
+// --width cells, and arenas are stacked with a gap between them.
+// image colours blend by bytes: allocated red, free (still resident) yellow,
+// purged dark grey, headers blue. the text view prints one character per page:
+//   '#' allocated  '+' mixed  '.' free  ' ' purged  'm' headers
+//
+// usage: jheatmap [--width N] [--scale N] [--ppm OUT] MAP.csv
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { K_ALLOC, K_FREE, K_PURGED, K_META, K_COUNT };
+
+typedef struct {
+    unsigned long arena, group, page;
+    unsigned long bytes[K_COUNT];
+} page_row_t;
+
+typedef struct {
+    page_row_t *rows;
+    size_t n, cap;
+} heap_map_t;
+
+static const unsigned char k_colors[K_COUNT][3] = {
+    { 220,  50,  40 }, // allocated
+    { 240, 200,  40 }, // free
+    {  60,  60,  64 }, // purged
+    {  50, 110, 230 }, // headers
+};
+
+static int map_read(const char *path, heap_map_t *m) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        page_row_t r;
+        // comments and the column header do not parse
+        if (sscanf(line, "%lu,%lu,%lu,%lu,%lu,%lu,%lu", &r.arena, &r.group, &r.page, &r.bytes[K_ALLOC],
+                   &r.bytes[K_FREE], &r.bytes[K_PURGED], &r.bytes[K_META]) != 7) continue;
+        if (m->n == m->cap) {
+            m->cap = m->cap ? m->cap * 2 : 1024;
+            m->rows = (page_row_t*)realloc(m->rows, m->cap * sizeof(page_row_t));
+            if (!m->rows) {
+                fclose(f);
+                return -1;
+            }
+        }
+        m->rows[m->n++] = r;
+    }
+    fclose(f);
+    return 0;
+}
+
+// rows of cells each arena takes at the given width
+static size_t arena_lines(const heap_map_t *m, size_t first, size_t width, size_t *end) {
+    size_t i = first;
+    while (i < m->n && m->rows[i].arena == m->rows[first].arena) i++;
+    *end = i;
+    return (i - first + width - 1) / width;
+}
+
+static char page_char(const page_row_t *r) {
+    unsigned long total = r->bytes[K_ALLOC] + r->bytes[K_FREE] + r->bytes[K_PURGED] + r->bytes[K_META];
+    if (!total) return ' ';
+    unsigned long unused = r->bytes[K_FREE] + r->bytes[K_PURGED];
+    if (r->bytes[K_META] * 2 > total) return 'm';
+    if (r->bytes[K_ALLOC] * 4 > total && unused * 4 > total) return '+';
+    if (unused * 2 <= total) return '#';
+    return r->bytes[K_PURGED] > r->bytes[K_FREE] ? ' ' : '.';
+}
+
+static void render_text(const heap_map_t *m, size_t width) {
+    for (size_t i = 0, end; i < m->n; i = end) {
+        size_t lines = arena_lines(m, i, width, &end);
+        unsigned long live = 0, total = 0;
+        for (size_t j = i; j < end; ++j) {
+            for (int k = 0; k < K_COUNT; ++k) total += m->rows[j].bytes[k];
+            live += m->rows[j].bytes[K_ALLOC];
+        }
+        printf("arena %lu (group %lu) %zu pages, %.1f%% allocated\n", m->rows[i].arena, m->rows[i].group,
+               end - i, total ? 100.0 * (double)live / (double)total : 0.0);
+        for (size_t l = 0; l < lines; ++l) {
+            putchar('|');
+            for (size_t j = i + l * width; j < end && j < i + (l + 1) * width; ++j) putchar(page_char(&m->rows[j]));
+            putchar('\n');
+        }
+    }
+}
+
+static int render_ppm(const heap_map_t *m, size_t width, size_t scale, const char *out) {
+    // one blank cell row between arenas
+    size_t cell_rows = 0;
+    for (size_t i = 0, end; i < m->n; i = end) cell_rows += arena_lines(m, i, width, &end) + 1;
+    size_t w = width * scale, h = cell_rows * scale;
+    unsigned char *img = (unsigned char*)calloc(w * h, 3);
+    if (!img) return -1;
+    memset(img, 255, w * h * 3);
+
+    size_t y = 0;
+    for (size_t i = 0, end; i < m->n; i = end) {
+        size_t lines = arena_lines(m, i, width, &end);
+        for (size_t j = i; j < end; ++j) {
+            const page_row_t *r = &m->rows[j];
+            unsigned long total = 0;
+            for (int k = 0; k < K_COUNT; ++k) total += r->bytes[k];
+            unsigned char rgb[3] = { 255, 255, 255 };
+            if (total) {
+                for (int c = 0; c < 3; ++c) {
+                    unsigned long v = 0;
+                    for (int k = 0; k < K_COUNT; ++k) v += r->bytes[k] * k_colors[k][c];
+                    rgb[c] = (unsigned char)(v / total);
+                }
+            }
+            size_t cx = (j - i) % width, cy = y + (j - i) / width;
+            for (size_t py = cy * scale; py < (cy + 1) * scale; ++py) {
+                for (size_t px = cx * scale; px < (cx + 1) * scale; ++px) memcpy(img + (py * w + px) * 3, rgb, 3);
+            }
+        }
+        y += lines + 1;
+    }
+
+    FILE *f = fopen(out, "wb");
+    if (!f) {
+        free(img);
+        return -1;
+    }
+    fprintf(f, "P6\n%zu %zu\n255\n", w, h);
+    size_t wrote = fwrite(img, 3, w * h, f);
+    free(img);
+    if (fclose(f) != 0 || wrote != w * h) return -1;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    size_t width = 64, scale = 4;
+    const char *ppm = NULL, *path = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) {
+            width = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ppm") == 0 && i + 1 < argc) {
+            ppm = argv[++i];
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (!path || width == 0 || scale == 0) {
+        fprintf(stderr, "usage: %s [--width N] [--scale N] [--ppm OUT] MAP.csv\n", argv[0]);
+        return 2;
+    }
+
+    heap_map_t m = {0};
+    if (map_read(path, &m) != 0) {
+        perror(path);
+        return 1;
+    }
+    if (!ppm) {
+        render_text(&m, width);
+    } else if (render_ppm(&m, width, scale, ppm) != 0) {
+        perror(ppm);
+        free(m.rows);
+        return 1;
+    }
+    free(m.rows);
+    return 0;
+}
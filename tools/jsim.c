@@ -0,0 +1,868 @@
+// jsim: offline placement simulator for jmalloc allocation traces
+// replays a trace recorded with j_trace_start against a model of the heap
+// (arenas, the block list, split, coalesce, in-place realloc and the placement
+// policies) without touching the simulated memory, and reports the footprint,
+// fragmentation over time and an estimate of the work every policy does.
+//
+// the model follows src/jmalloc.c block for block, so for a single-threaded
+// trace replayed under the policy it was recorded with, heap and free bytes
+// match what the allocator reported. the block scan counts are what the list
+// walking policies would visit; the address-ordered count is treap nodes.
+//
+// --map PREFIX writes the simulated heap as PREFIX-<policy>.csv in the
+// j_heap_map format (after op --map-at, or at the end) for tools/jheatmap.
+//
+// usage: jsim [--policy first|next|best|address|all] [--classes FILE]
+//             [--samples N] [--mmap down|up] [--map PREFIX [--map-at OP]] TRACE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "jmalloc.h"
+
+#define ALIGNMENT 8u
+#define ALIGN_UP(x, a) (((x) + ((a) - 1)) & ~((uint64_t)(a) - 1))
+#define ARENA_MIN_SIZE (1u << 20)
+#define HDR  ALIGN_UP(sizeof(block_header_t), ALIGNMENT)
+#define AHDR ALIGN_UP(sizeof(arena_header_t), ALIGNMENT)
+#define PAGE 4096u
+#define OFFSET_BITS 40 // block keys are arena sequence << OFFSET_BITS | offset
+
+// trace
+enum { OP_ALLOC, OP_FREE, OP_REALLOC };
+
+typedef struct {
+    uint8_t kind;
+    uint32_t id;   // object, dense from 0
+    uint64_t size; // requested bytes (alloc, realloc)
+} op_t;
+
+typedef struct {
+    op_t *ops;
+    size_t n, cap;
+    uint32_t objects;
+    size_t unmatched; // frees/reallocs of pointers allocated before the trace started
+} trace_t;
+
+// pointer -> live object id, open addressing with tombstones
+typedef struct {
+    uint64_t *keys; // 0 = empty, 1 = deleted
+    uint32_t *vals;
+    size_t cap, used;
+} ptrmap_t;
+
+static size_t ptr_slot(uint64_t k, size_t cap) {
+    return (size_t)((k * 0x9E3779B97F4A7C15ull) >> 20) & (cap - 1);
+}
+
+static void ptrmap_grow(ptrmap_t *m) {
+    size_t old_cap = m->cap;
+    uint64_t *ok = m->keys;
+    uint32_t *ov = m->vals;
+    m->cap = old_cap ? old_cap * 2 : 1024;
+    m->keys = (uint64_t*)calloc(m->cap, sizeof(uint64_t));
+    m->vals = (uint32_t*)malloc(m->cap * sizeof(uint32_t));
+    if (!m->keys || !m->vals) {
+        fprintf(stderr, "jsim: out of memory\n");
+        exit(1);
+    }
+    m->used = 0;
+    for (size_t i = 0; i < old_cap; ++i) {
+        if (ok[i] <= 1) continue;
+        size_t s = ptr_slot(ok[i], m->cap);
+        while (m->keys[s]) s = (s + 1) & (m->cap - 1);
+        m->keys[s] = ok[i];
+        m->vals[s] = ov[i];
+        m->used++;
+    }
+    free(ok);
+    free(ov);
+}
+
+// slot holding k, or the empty slot that ends its probe sequence
+static size_t ptrmap_find(const ptrmap_t *m, uint64_t k) {
+    size_t s = ptr_slot(k, m->cap);
+    while (m->keys[s] && m->keys[s] != k) s = (s + 1) & (m->cap - 1);
+    return s;
+}
+
+static void ptrmap_put(ptrmap_t *m, uint64_t k, uint32_t v) {
+    if ((m->used + 1) * 2 > m->cap) ptrmap_grow(m);
+    size_t s = ptrmap_find(m, k);
+    if (!m->keys[s]) m->used++;
+    m->keys[s] = k;
+    m->vals[s] = v;
+}
+
+// removes k and returns its id, or -1 if k is not live
+static long ptrmap_take(ptrmap_t *m, uint64_t k) {
+    if (!m->cap) return -1;
+    size_t s = ptrmap_find(m, k);
+    if (!m->keys[s]) return -1;
+    m->keys[s] = 1;
+    return m->vals[s];
+}
+
+static void trace_push(trace_t *t, uint8_t kind, uint32_t id, uint64_t size) {
+    if (t->n == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 4096;
+        t->ops = (op_t*)realloc(t->ops, t->cap * sizeof(op_t));
+        if (!t->ops) {
+            fprintf(stderr, "jsim: out of memory\n");
+            exit(1);
+        }
+    }
+    t->ops[t->n].kind = kind;
+    t->ops[t->n].id = id;
+    t->ops[t->n].size = size;
+    t->n++;
+}
+
+// "a <ptr> <size>", "f <ptr>", "r <old> <new> <size>"; '#' starts a comment
+static int trace_read(const char *path, trace_t *t) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    ptrmap_t live = {0};
+    char line[256];
+    size_t lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        unsigned long long p, q, size;
+        long id;
+        switch (line[0]) {
+        case 'a':
+            if (sscanf(line + 1, "%llx %llu", &p, &size) != 2) goto bad;
+            // a pointer handed out twice means its free was not traced, drop the old object
+            ptrmap_take(&live, p);
+            ptrmap_put(&live, p, t->objects);
+            trace_push(t, OP_ALLOC, t->objects++, size);
+            break;
+        case 'f':
+            if (sscanf(line + 1, "%llx", &p) != 1) goto bad;
+            id = ptrmap_take(&live, p);
+            if (id < 0) t->unmatched++;
+            else trace_push(t, OP_FREE, (uint32_t)id, 0);
+            break;
+        case 'r':
+            if (sscanf(line + 1, "%llx %llx %llu", &p, &q, &size) != 3) goto bad;
+            id = ptrmap_take(&live, p);
+            if (id < 0) {
+                t->unmatched++;
+                ptrmap_put(&live, q, t->objects);
+                trace_push(t, OP_ALLOC, t->objects++, size);
+            } else {
+                ptrmap_put(&live, q, (uint32_t)id);
+                trace_push(t, OP_REALLOC, (uint32_t)id, size);
+            }
+            break;
+        case '#': case '\n': case '\r':
+            break;
+        default:
+            goto bad;
+        }
+    }
+    fclose(f);
+    free(live.keys);
+    free(live.vals);
+    return 0;
+bad:
+    fprintf(stderr, "jsim: %s:%zu: bad record\n", path, lineno);
+    fclose(f);
+    free(live.keys);
+    free(live.vals);
+    errno = EINVAL;
+    return -1;
+}
+
+// size classes, same file format and rounding as j_sizeclass_load
+static uint32_t g_sc_round[J_SIZECLASS_BINS];
+static uint64_t g_sc_limit = 0;
+
+static int classes_load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    uint64_t classes[J_SIZECLASS_MAX_COUNT];
+    size_t n = 0;
+    char line[64];
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), f)) {
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') continue;
+        char *end;
+        unsigned long long v = strtoull(p, &end, 10);
+        if (end == p || n == J_SIZECLASS_MAX_COUNT || v == 0 || v % ALIGNMENT ||
+            v > J_SIZECLASS_MAX_BYTES || (n && v <= classes[n - 1])) ok = 0;
+        else classes[n++] = v;
+    }
+    fclose(f);
+    if (!ok || n == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t c = 0;
+    for (uint64_t size = ALIGNMENT; size <= classes[n - 1]; size += ALIGNMENT) {
+        while (classes[c] < size) c++;
+        g_sc_round[size / ALIGNMENT - 1] = (uint32_t)classes[c];
+    }
+    g_sc_limit = classes[n - 1];
+    return 0;
+}
+
+// simulated heap
+// the block list is kept as in jmalloc; three treaps index it for the searches:
+// every block by list position (carrying the largest free size and the block
+// count per subtree, which gives first/next-fit results and scan lengths),
+// free blocks by simulated address, and free blocks by (size, list position)
+enum { T_LIST, T_ADDR, T_SIZE, T_COUNT };
+
+typedef struct sblock sblock_t;
+typedef struct {
+    sblock_t *left, *right;
+    uint32_t prio;
+    uint32_t count;   // blocks in this subtree
+    uint64_t max_free; // largest free size in this subtree
+} tlink_t;
+
+struct sblock {
+    uint64_t key;  // list position
+    uint64_t addr; // simulated address
+    uint64_t size; // payload
+    int free;
+    sblock_t *next, *prev;
+    tlink_t t[T_COUNT];
+};
+
+typedef struct {
+    uint64_t peak_mapped, peak_live;
+    uint64_t arenas;
+    uint64_t searches;
+    uint64_t scanned;  // blocks (treap nodes for address) looked at by searches
+    uint64_t splits, merges;
+    uint64_t grow_in_place, shrink_in_place, moved, copied;
+    double frag_sum, frag_peak;
+    uint64_t samples;
+} sim_stats_t;
+
+typedef struct {
+    int policy;
+    int mmap_up;
+    sblock_t *head, *tail, *rover;
+    sblock_t *root[T_COUNT];
+    uint64_t blocks;
+    uint64_t mapped, free_bytes, live;
+    uint64_t next_seq, next_base;
+    uint64_t *arena_size; // by arena sequence
+    const char *map_prefix;
+    size_t map_at;        // op after which the map is written, 0 = end
+    sblock_t **objs;    // object id -> block
+    uint64_t *req;      // object id -> requested size
+    sblock_t *spare;    // recycled block records, linked by next
+    uint32_t seed;
+    sim_stats_t st;
+} sim_t;
+
+static const char *k_policy_names[J_POLICY_COUNT] = { "first", "next", "best", "address" };
+
+static sblock_t* block_new(sim_t *s) {
+    sblock_t *b = s->spare;
+    if (b) s->spare = b->next;
+    else if (!(b = (sblock_t*)malloc(sizeof(sblock_t)))) {
+        fprintf(stderr, "jsim: out of memory\n");
+        exit(1);
+    }
+    memset(b, 0, sizeof(*b));
+    s->blocks++;
+    return b;
+}
+
+static void block_drop(sim_t *s, sblock_t *b) {
+    b->next = s->spare;
+    s->spare = b;
+    s->blocks--;
+}
+
+// treap keyed per tree
+static int tree_less(int w, const sblock_t *a, const sblock_t *b) {
+    switch (w) {
+    case T_ADDR: return a->addr < b->addr;
+    case T_SIZE: return a->size < b->size || (a->size == b->size && a->key < b->key);
+    default:     return a->key < b->key;
+    }
+}
+
+static inline uint32_t t_count(int w, const sblock_t *n) { return n ? n->t[w].count : 0; }
+static inline uint64_t t_max(int w, const sblock_t *n) { return n ? n->t[w].max_free : 0; }
+
+static void t_update(int w, sblock_t *n) {
+    tlink_t *l = &n->t[w];
+    uint64_t m = n->free ? n->size : 0;
+    if (t_max(w, l->left) > m) m = t_max(w, l->left);
+    if (t_max(w, l->right) > m) m = t_max(w, l->right);
+    l->max_free = m;
+    l->count = 1 + t_count(w, l->left) + t_count(w, l->right);
+}
+
+static void t_split(int w, sblock_t *t, const sblock_t *key, sblock_t **lo, sblock_t **hi) {
+    if (!t) {
+        *lo = *hi = NULL;
+        return;
+    }
+    if (tree_less(w, t, key)) {
+        t_split(w, t->t[w].right, key, &t->t[w].right, hi);
+        *lo = t;
+    } else {
+        t_split(w, t->t[w].left, key, lo, &t->t[w].left);
+        *hi = t;
+    }
+    t_update(w, t);
+}
+
+static sblock_t* t_merge(int w, sblock_t *a, sblock_t *b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->t[w].prio > b->t[w].prio) {
+        a->t[w].right = t_merge(w, a->t[w].right, b);
+        t_update(w, a);
+        return a;
+    }
+    b->t[w].left = t_merge(w, a, b->t[w].left);
+    t_update(w, b);
+    return b;
+}
+
+static sblock_t* t_insert(int w, sblock_t *t, sblock_t *n) {
+    if (!t) return n;
+    if (n->t[w].prio > t->t[w].prio) {
+        t_split(w, t, n, &n->t[w].left, &n->t[w].right);
+        t_update(w, n);
+        return n;
+    }
+    if (tree_less(w, n, t)) t->t[w].left = t_insert(w, t->t[w].left, n);
+    else t->t[w].right = t_insert(w, t->t[w].right, n);
+    t_update(w, t);
+    return t;
+}
+
+static sblock_t* t_erase(int w, sblock_t *t, const sblock_t *n) {
+    if (!t) return NULL;
+    if (t == n) return t_merge(w, t->t[w].left, t->t[w].right);
+    if (tree_less(w, n, t)) t->t[w].left = t_erase(w, t->t[w].left, n);
+    else t->t[w].right = t_erase(w, t->t[w].right, n);
+    t_update(w, t);
+    return t;
+}
+
+// which trees hold b: every block is in T_LIST, free ones in the policy's tree
+static int in_tree(const sim_t *s, int w, const sblock_t *b) {
+    if (w == T_LIST) return 1;
+    if (!b->free) return 0;
+    return (w == T_ADDR && s->policy == J_POLICY_ADDRESS_ORDERED) ||
+           (w == T_SIZE && s->policy == J_POLICY_BEST_FIT);
+}
+
+// a block leaves the indexes before its size or state changes and comes back after
+static void idx_del(sim_t *s, sblock_t *b) {
+    for (int w = 0; w < T_COUNT; ++w) {
+        if (in_tree(s, w, b)) s->root[w] = t_erase(w, s->root[w], b);
+    }
+}
+
+static void idx_add(sim_t *s, sblock_t *b) {
+    for (int w = 0; w < T_COUNT; ++w) {
+        if (!in_tree(s, w, b)) continue;
+        s->seed ^= s->seed << 13;
+        s->seed ^= s->seed >> 17;
+        s->seed ^= s->seed << 5;
+        b->t[w].left = b->t[w].right = NULL;
+        b->t[w].prio = s->seed;
+        t_update(w, b);
+        s->root[w] = t_insert(w, s->root[w], b);
+    }
+}
+
+// blocks in front of b in list order
+static uint64_t list_rank(const sim_t *s, const sblock_t *b) {
+    uint64_t r = 0;
+    for (const sblock_t *t = s->root[T_LIST]; t;) {
+        if (t == b) return r + t_count(T_LIST, t->t[T_LIST].left);
+        if (b->key < t->key) {
+            t = t->t[T_LIST].left;
+        } else {
+            r += t_count(T_LIST, t->t[T_LIST].left) + 1;
+            t = t->t[T_LIST].right;
+        }
+    }
+    return r;
+}
+
+// first free block of at least size at or after list position lo
+static sblock_t* list_find_from(sblock_t *t, uint64_t lo, uint64_t size) {
+    if (!t || t_max(T_LIST, t) < size) return NULL;
+    if (t->key < lo) return list_find_from(t->t[T_LIST].right, lo, size);
+    sblock_t *r = list_find_from(t->t[T_LIST].left, lo, size);
+    if (r) return r;
+    if (t->free && t->size >= size) return t;
+    return list_find_from(t->t[T_LIST].right, lo, size);
+}
+
+// the policies; each returns the block jmalloc would pick and adds to scanned
+// the blocks its search would have looked at
+static sblock_t* find_first(sim_t *s, uint64_t size) {
+    sblock_t *b = list_find_from(s->root[T_LIST], 0, size);
+    s->st.scanned += b ? list_rank(s, b) + 1 : s->blocks;
+    return b;
+}
+
+static sblock_t* find_next(sim_t *s, uint64_t size) {
+    sblock_t *start = s->rover ? s->rover : s->head;
+    if (!start) return NULL;
+    uint64_t r0 = list_rank(s, start);
+    sblock_t *b = list_find_from(s->root[T_LIST], start->key, size);
+    if (b) {
+        s->st.scanned += list_rank(s, b) - r0 + 1;
+    } else {
+        b = list_find_from(s->root[T_LIST], 0, size);
+        if (b && b->key >= start->key) b = NULL;
+        s->st.scanned += b ? s->blocks - r0 + list_rank(s, b) + 1 : s->blocks;
+    }
+    if (b) s->rover = b;
+    return b;
+}
+
+static sblock_t* find_best(sim_t *s, uint64_t size) {
+    // smallest fitting size, the earliest in the list among equals
+    sblock_t *b = NULL;
+    for (sblock_t *t = s->root[T_SIZE]; t;) {
+        if (t->size >= size) {
+            b = t;
+            t = t->t[T_SIZE].left;
+        } else {
+            t = t->t[T_SIZE].right;
+        }
+    }
+    // the list walk stops early only on an exact fit
+    s->st.scanned += b && b->size == size ? list_rank(s, b) + 1 : s->blocks;
+    return b;
+}
+
+static sblock_t* find_address(sim_t *s, uint64_t size) {
+    sblock_t *t = s->root[T_ADDR];
+    if (t_max(T_ADDR, t) < size) return NULL;
+    for (;;) {
+        s->st.scanned++;
+        if (t_max(T_ADDR, t->t[T_ADDR].left) >= size) t = t->t[T_ADDR].left;
+        else if (t->size >= size) return t;
+        else t = t->t[T_ADDR].right;
+    }
+}
+
+static sblock_t* sim_find(sim_t *s, uint64_t size) {
+    s->st.searches++;
+    switch (s->policy) {
+    case J_POLICY_NEXT_FIT:        return find_next(s, size);
+    case J_POLICY_BEST_FIT:        return find_best(s, size);
+    case J_POLICY_ADDRESS_ORDERED: return find_address(s, size);
+    default:                       return find_first(s, size);
+    }
+}
+
+static inline int adjacent(const sblock_t *a, const sblock_t *b) {
+    return a->key + HDR + a->size == b->key;
+}
+
+// a free block is about to stop being one (policy remove_free)
+static void take_free(sim_t *s, sblock_t *b) {
+    idx_del(s, b);
+    if (s->rover == b) s->rover = b->next;
+}
+
+static void unlink_block(sim_t *s, sblock_t *b) {
+    if (b->prev) b->prev->next = b->next;
+    else s->head = b->next;
+    if (b->next) b->next->prev = b->prev;
+    else s->tail = b->prev;
+}
+
+// b is out of the indexes; cut it to want and index the free remainder
+static void split(sim_t *s, sblock_t *b, uint64_t want) {
+    uint64_t remain = b->size - want;
+    b->size = want;
+    sblock_t *n = block_new(s);
+    n->key = b->key + HDR + want;
+    n->addr = b->addr + HDR + want;
+    n->size = remain - HDR;
+    n->free = 1;
+    n->prev = b;
+    n->next = b->next;
+    if (n->next) n->next->prev = n;
+    else s->tail = n;
+    b->next = n;
+    s->free_bytes += n->size;
+    s->st.splits++;
+    sblock_t *after = n->next;
+    if (after && after->free && adjacent(n, after)) {
+        take_free(s, after);
+        n->size += HDR + after->size;
+        unlink_block(s, after);
+        block_drop(s, after);
+        s->free_bytes += HDR;
+        s->st.merges++;
+    }
+    idx_add(s, n);
+}
+
+static sblock_t* new_arena(sim_t *s, uint64_t size) {
+    uint64_t need = HDR + size;
+    uint64_t total = AHDR + (need > ARENA_MIN_SIZE ? need : ARENA_MIN_SIZE);
+    uint64_t span = ALIGN_UP(total, PAGE);
+    uint64_t base;
+    // mmap on Linux hands out descending addresses, which is what address-ordered fit sees
+    if (s->mmap_up) {
+        base = s->next_base;
+        s->next_base += span;
+    } else {
+        s->next_base -= span;
+        base = s->next_base;
+    }
+    sblock_t *b = block_new(s);
+    if ((s->next_seq & (s->next_seq - 1)) == 0) {
+        // grow the size table at powers of two
+        s->arena_size = (uint64_t*)realloc(s->arena_size, (s->next_seq ? s->next_seq * 2 : 1) * sizeof(uint64_t));
+        if (!s->arena_size) {
+            fprintf(stderr, "jsim: out of memory\n");
+            exit(1);
+        }
+    }
+    s->arena_size[s->next_seq] = total;
+    b->key = (s->next_seq++ << OFFSET_BITS) | AHDR;
+    b->addr = base + AHDR;
+    b->size = size;
+    b->prev = s->tail;
+    if (s->tail) s->tail->next = b;
+    else s->head = b;
+    s->tail = b;
+    s->mapped += total;
+    s->st.arenas++;
+    if (s->mapped > s->st.peak_mapped) s->st.peak_mapped = s->mapped;
+
+    uint64_t used = AHDR + HDR + size;
+    if (total >= used + HDR + ALIGNMENT) {
+        sblock_t *f = block_new(s);
+        f->key = b->key + HDR + size;
+        f->addr = b->addr + HDR + size;
+        f->size = total - used - HDR;
+        f->free = 1;
+        f->prev = b;
+        b->next = f;
+        s->tail = f;
+        s->free_bytes += f->size;
+        idx_add(s, f);
+    }
+    idx_add(s, b);
+    return b;
+}
+
+static uint64_t round_size(uint64_t size) {
+    size = ALIGN_UP(size, ALIGNMENT);
+    if (size <= g_sc_limit) size = g_sc_round[size / ALIGNMENT - 1];
+    return size;
+}
+
+static sblock_t* sim_malloc(sim_t *s, uint64_t size) {
+    size = round_size(size);
+    sblock_t *b = sim_find(s, size);
+    if (!b) return new_arena(s, size);
+    uint64_t old = b->size;
+    take_free(s, b);
+    if (old >= size + HDR + ALIGNMENT) split(s, b, size);
+    b->free = 0;
+    s->free_bytes -= old;
+    idx_add(s, b);
+    return b;
+}
+
+static void sim_free(sim_t *s, sblock_t *b) {
+    idx_del(s, b);
+    b->free = 1;
+    s->free_bytes += b->size;
+    if (b->next && b->next->free && adjacent(b, b->next)) {
+        sblock_t *n = b->next;
+        take_free(s, n);
+        b->size += HDR + n->size;
+        unlink_block(s, n);
+        block_drop(s, n);
+        s->free_bytes += HDR;
+        s->st.merges++;
+    }
+    if (b->prev && b->prev->free && adjacent(b->prev, b)) {
+        sblock_t *p = b->prev;
+        take_free(s, p);
+        p->size += HDR + b->size;
+        unlink_block(s, b);
+        if (s->rover == b) s->rover = p;
+        block_drop(s, b);
+        s->free_bytes += HDR;
+        s->st.merges++;
+        b = p;
+    }
+    idx_add(s, b);
+}
+
+static sblock_t* sim_realloc(sim_t *s, sblock_t *b, uint64_t size) {
+    size = round_size(size);
+    uint64_t old = b->size;
+    if (old >= size) {
+        if (old >= size + HDR + ALIGNMENT) {
+            idx_del(s, b);
+            split(s, b, size);
+            idx_add(s, b);
+        }
+        s->st.shrink_in_place++;
+        return b;
+    }
+    sblock_t *n = b->next;
+    if (n && n->free && adjacent(b, n) && old + HDR + n->size >= size) {
+        take_free(s, n);
+        idx_del(s, b);
+        b->size += HDR + n->size;
+        unlink_block(s, n);
+        s->free_bytes -= n->size;
+        block_drop(s, n);
+        if (b->size >= size + HDR + ALIGNMENT) split(s, b, size);
+        idx_add(s, b);
+        s->st.grow_in_place++;
+        return b;
+    }
+    sblock_t *nb = sim_malloc(s, size);
+    s->st.copied += old < size ? old : size;
+    s->st.moved++;
+    sim_free(s, b);
+    return nb;
+}
+
+static void sim_sample(sim_t *s, size_t op, int print) {
+    uint64_t largest = t_max(T_LIST, s->root[T_LIST]);
+    double frag = s->free_bytes ? 1.0 - (double)largest / (double)s->free_bytes : 0.0;
+    s->st.frag_sum += frag;
+    if (frag > s->st.frag_peak) s->st.frag_peak = frag;
+    s->st.samples++;
+    if (print) {
+        printf("%-10zu  %-11llu  %-11llu  %-11llu  %-11llu  %.3f\n", op, (unsigned long long)s->live,
+               (unsigned long long)s->mapped, (unsigned long long)s->free_bytes,
+               (unsigned long long)largest, frag);
+    }
+}
+
+// heap map, the same rows j_heap_map writes (nothing is ever purged here)
+enum { MAP_ALLOC, MAP_FREE, MAP_PURGED, MAP_META, MAP_KINDS };
+
+typedef struct {
+    FILE *f;
+    uint64_t arena, page;
+    uint64_t bytes[MAP_KINDS];
+} map_out_t;
+
+static void map_flush(map_out_t *m) {
+    fprintf(m->f, "%llu,0,%llu,%llu,%llu,%llu,%llu\n", (unsigned long long)m->arena, (unsigned long long)m->page,
+            (unsigned long long)m->bytes[MAP_ALLOC], (unsigned long long)m->bytes[MAP_FREE],
+            (unsigned long long)m->bytes[MAP_PURGED], (unsigned long long)m->bytes[MAP_META]);
+    memset(m->bytes, 0, sizeof(m->bytes));
+}
+
+static void map_add(map_out_t *m, uint64_t off, uint64_t len, int kind) {
+    while (len) {
+        uint64_t page = off / PAGE;
+        if (page != m->page) {
+            map_flush(m);
+            m->page = page;
+        }
+        uint64_t take = (page + 1) * PAGE - off;
+        if (take > len) take = len;
+        m->bytes[kind] += take;
+        off += take;
+        len -= take;
+    }
+}
+
+static void sim_write_map(const sim_t *s) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s-%s.csv", s->map_prefix, k_policy_names[s->policy]);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    map_out_t m;
+    memset(&m, 0, sizeof(m));
+    m.f = f;
+    fprintf(f, "# jmalloc heap map v1 page_size=%u policy=%s (simulated)\n", PAGE, k_policy_names[s->policy]);
+    fputs("arena,group,page,alloc,free,purged,meta\n", f);
+    // list order is arena order, and address order inside an arena
+    const sblock_t *b = s->head;
+    for (uint64_t a = 0; a < s->next_seq; ++a) {
+        m.arena = a;
+        m.page = 0;
+        map_add(&m, 0, AHDR, MAP_META);
+        uint64_t off = AHDR;
+        for (; b && b->key >> OFFSET_BITS == a; b = b->next) {
+            off = b->key & ((1ull << OFFSET_BITS) - 1);
+            map_add(&m, off, HDR, MAP_META);
+            map_add(&m, off + HDR, b->size, b->free ? MAP_FREE : MAP_ALLOC);
+            off += HDR + b->size;
+        }
+        map_add(&m, off, s->arena_size[a] - off, MAP_META);
+        map_flush(&m);
+    }
+    fclose(f);
+    printf("heap map: %s\n", path);
+}
+
+static void sim_run(sim_t *s, const trace_t *t, size_t every, int print) {
+    s->objs = (sblock_t**)calloc(t->objects ? t->objects : 1, sizeof(sblock_t*));
+    s->req = (uint64_t*)calloc(t->objects ? t->objects : 1, sizeof(uint64_t));
+    if (!s->objs || !s->req) {
+        fprintf(stderr, "jsim: out of memory\n");
+        exit(1);
+    }
+    s->seed = 2463534242u;
+    s->next_base = s->mmap_up ? (1ull << 32) : (1ull << 46);
+    if (print) printf("op          live(B)      heap(B)      free(B)      largest(B)   frag\n");
+    for (size_t i = 0; i < t->n; ++i) {
+        const op_t *o = &t->ops[i];
+        switch (o->kind) {
+        case OP_ALLOC:
+            // zero-byte requests return NULL and are never traced
+            s->objs[o->id] = sim_malloc(s, o->size);
+            s->req[o->id] = o->size;
+            s->live += o->size;
+            break;
+        case OP_FREE:
+            sim_free(s, s->objs[o->id]);
+            s->objs[o->id] = NULL;
+            s->live -= s->req[o->id];
+            break;
+        case OP_REALLOC:
+            s->objs[o->id] = sim_realloc(s, s->objs[o->id], o->size);
+            s->live += o->size - s->req[o->id];
+            s->req[o->id] = o->size;
+            break;
+        }
+        if (s->live > s->st.peak_live) s->st.peak_live = s->live;
+        if (every && (i + 1) % every == 0) sim_sample(s, i + 1, print);
+        if (s->map_prefix && s->map_at == i + 1) sim_write_map(s);
+    }
+    if (s->map_prefix && (s->map_at == 0 || s->map_at > t->n)) sim_write_map(s);
+    if (!every || t->n % every) sim_sample(s, t->n, print);
+}
+
+static void sim_release(sim_t *s) {
+    for (sblock_t *b = s->head; b;) {
+        sblock_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    while (s->spare) {
+        sblock_t *next = s->spare->next;
+        free(s->spare);
+        s->spare = next;
+    }
+    free(s->objs);
+    free(s->req);
+    free(s->arena_size);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [--policy first|next|best|address|all] [--classes FILE] "
+                    "[--samples N] [--mmap down|up] [--map PREFIX [--map-at OP]] TRACE\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    int policy = -1; // all
+    int mmap_up = 0;
+    const char *map_prefix = NULL;
+    size_t map_at = 0;
+    size_t samples = 20;
+    const char *path = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+            const char *name = argv[++i];
+            policy = -2;
+            if (strcmp(name, "all") == 0) policy = -1;
+            for (int p = 0; p < J_POLICY_COUNT; ++p) {
+                if (strcmp(name, k_policy_names[p]) == 0) policy = p;
+            }
+            if (policy == -2) {
+                usage(argv[0]);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--classes") == 0 && i + 1 < argc) {
+            if (classes_load(argv[++i]) != 0) {
+                fprintf(stderr, "jsim: cannot load size classes from %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            samples = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc) {
+            map_prefix = argv[++i];
+        } else if (strcmp(argv[i], "--map-at") == 0 && i + 1 < argc) {
+            map_at = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--mmap") == 0 && i + 1 < argc) {
+            mmap_up = strcmp(argv[++i], "up") == 0;
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!path) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    trace_t t = {0};
+    if (trace_read(path, &t) != 0) {
+        if (errno != EINVAL) perror(path);
+        return 1;
+    }
+    printf("trace: %zu ops, %u objects", t.n, t.objects);
+    if (t.unmatched) printf(", %zu ops on pointers from before the trace", t.unmatched);
+    printf("\n");
+    size_t every = samples ? (t.n + samples - 1) / samples : 0;
+
+    int first = policy < 0 ? 0 : policy;
+    int last = policy < 0 ? J_POLICY_COUNT - 1 : policy;
+    sim_stats_t res[J_POLICY_COUNT];
+    uint64_t final_mapped[J_POLICY_COUNT], final_free[J_POLICY_COUNT];
+    for (int p = first; p <= last; ++p) {
+        sim_t s;
+        memset(&s, 0, sizeof(s));
+        s.policy = p;
+        s.mmap_up = mmap_up;
+        s.map_prefix = map_prefix;
+        s.map_at = map_at;
+        if (policy >= 0) printf("== policy %s ==\n", k_policy_names[p]);
+        sim_run(&s, &t, every, policy >= 0);
+        res[p] = s.st;
+        final_mapped[p] = s.mapped;
+        final_free[p] = s.free_bytes;
+        sim_release(&s);
+    }
+
+    printf("\npolicy    peak heap(B)  end heap(B)  end free(B)  arenas  avg frag  peak frag  "
+           "scan/find   splits    merges    moved\n");
+    for (int p = first; p <= last; ++p) {
+        const sim_stats_t *r = &res[p];
+        printf("%-8s  %-12llu  %-11llu  %-11llu  %-6llu  %.3f     %.3f      %-10.1f  %-8llu  %-8llu  %llu\n",
+               k_policy_names[p], (unsigned long long)r->peak_mapped, (unsigned long long)final_mapped[p],
+               (unsigned long long)final_free[p], (unsigned long long)r->arenas,
+               r->samples ? r->frag_sum / (double)r->samples : 0.0, r->frag_peak,
+               r->searches ? (double)r->scanned / (double)r->searches : 0.0, (unsigned long long)r->splits,
+               (unsigned long long)r->merges, (unsigned long long)r->moved);
+    }
+    printf("peak live: %llu B\n", (unsigned long long)res[first].peak_live);
+    free(t.ops);
+    return 0;
+}